@@ -24,6 +24,7 @@ int main(int argc, char** argv)
     std::string algo = "bnb";
     bool smooth = false;
     bool open_viewer = false;
+    int num_threads = 1;
 
     cxxopts::Options opts("embed",
         "Embeds a given layout into a target mesh.\n"
@@ -43,6 +44,7 @@ int main(int argc, char** argv)
     opts.add_options()("a,algo", "Algorithm, one of: bnb, greedy, praun, kraevoy, schreiner.", cxxopts::value<std::string>()->default_value("bnb"));
     opts.add_options()("s,smooth", "Apply smoothing post-process based on [Praun2001].", cxxopts::value<bool>());
     opts.add_options()("v,viewer", "Open a window to inspect the resulting embedding.", cxxopts::value<bool>());
+    opts.add_options()("j,threads", "Number of branch-and-bound worker threads. Use 0 for all available cores.", cxxopts::value<int>()->default_value("1"));
     opts.add_options()("h,help", "Help.");
     opts.parse_positional({"layout", "target"});
     opts.positional_help("[layout] [target]");
@@ -61,6 +63,7 @@ int main(int argc, char** argv)
 
         smooth = args["smooth"].as<bool>();
         open_viewer = args["viewer"].as<bool>();
+        num_threads = args["threads"].as<int>();
 
         if (args.count("help") || args.count("layout") == 0 || args.count("target") == 0) {
             std::cout << opts.help() << std::endl;
@@ -89,8 +92,11 @@ int main(int argc, char** argv)
         embed_kraevoy(em);
     else if (algo == "schreiner")
         embed_schreiner(em);
-    else if (algo == "bnb")
-        branch_and_bound(em);
+    else if (algo == "bnb") {
+        BranchAndBoundSettings settings;
+        settings.num_threads = num_threads;
+        branch_and_bound(em, settings);
+    }
     else
         LE_ASSERT(false);
 
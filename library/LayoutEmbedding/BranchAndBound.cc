@@ -4,25 +4,27 @@
 #include <LayoutEmbedding/EmbeddingState.hh>
 #include <LayoutEmbedding/GetQueueContainer.hh>
 #include <LayoutEmbedding/Greedy.hh>
+#include <LayoutEmbedding/LowerBounds.hh>
+#include <LayoutEmbedding/StateTree.hh>
 #include <LayoutEmbedding/Util/Assert.hh>
 
 #include <glow-extras/timing/CpuTimer.hh>
 
+#include <omp.h>
+
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <list>
+#include <memory>
+#include <mutex>
 #include <queue>
+#include <unordered_map>
 
 namespace LayoutEmbedding {
 
-struct State
-{
-    HashValue parent;
-    std::vector<HashValue> children;
-    pm::edge_index l_e;
-    VirtualPath path;
-    std::vector<VirtualPath> candidate_paths;
-    std::set<std::pair<pm::edge_index, pm::edge_index>> candidate_conflicts;
-};
-
 struct Candidate
 {
     double lower_bound = std::numeric_limits<double>::infinity();
@@ -36,6 +38,50 @@ struct Candidate
     }
 };
 
+/// Small LRU cache of materialized EmbeddingStates, keyed by state hash.
+/// Reconstructing a state then only requires replaying the insertions since its closest cached ancestor
+/// instead of all insertions since the root.
+class EmbeddingStateCache
+{
+public:
+    explicit EmbeddingStateCache(int _capacity) :
+        capacity(_capacity)
+    {
+    }
+
+    bool contains(const HashValue _hash) const
+    {
+        return index.count(_hash) > 0;
+    }
+
+    const EmbeddingState& get(const HashValue _hash)
+    {
+        auto it = index.at(_hash);
+        entries.splice(entries.begin(), entries, it); // Mark as most recently used
+        return *it->second;
+    }
+
+    void insert(const HashValue _hash, std::unique_ptr<EmbeddingState> _es)
+    {
+        if (capacity <= 0 || contains(_hash)) {
+            return;
+        }
+        if ((int)entries.size() >= capacity) {
+            index.erase(entries.back().first);
+            entries.pop_back();
+        }
+        entries.emplace_front(_hash, std::move(_es));
+        index[_hash] = entries.begin();
+    }
+
+private:
+    using Entry = std::pair<HashValue, std::unique_ptr<EmbeddingState>>;
+
+    int capacity;
+    std::list<Entry> entries; // Most recently used first
+    std::unordered_map<HashValue, std::list<Entry>::iterator> index;
+};
+
 BranchAndBoundResult branch_and_bound(Embedding& _em, const BranchAndBoundSettings& _settings, const std::string& _name)
 {
     glow::timing::CpuTimer timer;
@@ -43,7 +89,9 @@ BranchAndBoundResult branch_and_bound(Embedding& _em, const BranchAndBoundSettin
     BranchAndBoundResult result(_name, _settings);
 
     InsertionSequence best_insertion_sequence;
-    double global_upper_bound = std::numeric_limits<double>::infinity();
+
+    // Read without locking by all workers (for pruning), written only while holding the mutex below.
+    std::atomic<double> global_upper_bound(std::numeric_limits<double>::infinity());
 
     if (_settings.record_lower_bound_events) {
         BranchAndBoundResult::LowerBoundEvent event;
@@ -74,18 +122,13 @@ BranchAndBoundResult branch_and_bound(Embedding& _em, const BranchAndBoundSettin
         }
     }
 
-    std::map<HashValue, State> known_states;
+    StateTree known_states(_em.layout_mesh().edges().size(), _settings.state_tree_memory_budget);
     {
         EmbeddingState es(_em, _settings);
         es.compute_all_candidate_paths();
         es.detect_candidate_path_conflicts();
 
-        State root;
-        root.parent = 0;
-        root.candidate_paths = es.candidate_paths.to_vector();
-        root.candidate_conflicts = es.conflicts;
-
-        known_states[0] = root;
+        known_states.insert_root(es.candidate_paths.to_vector(), es.conflicts);
     }
 
     // Init priority queue with empty state.
@@ -98,270 +141,635 @@ BranchAndBoundResult branch_and_bound(Embedding& _em, const BranchAndBoundSettin
         q.push(c);
     }
 
-    int iter = 0;
-    while (!q.empty()) {
-        ++iter;
-
-        // Time limit
-        if (_settings.time_limit > 0.0) {
-            if (timer.elapsedSecondsD() >= _settings.time_limit) {
-                std::cout << "Reached time limit of " << _settings.time_limit << " s. Terminating." << std::endl;
-                if (std::isinf(global_upper_bound)) {
-                    std::cout << "Warning: No valid solution was found within that time." << std::endl;
-                }
-                break;
-            }
+    const int num_threads = (_settings.num_threads > 0) ? _settings.num_threads : omp_get_max_threads();
+
+    // Attributes can't be registered on a mesh concurrently.
+    // Thus, each worker builds its EmbeddingStates on top of its own copy of the input (and layout mesh).
+    std::deque<EmbeddingInput> worker_inputs;
+    std::deque<Embedding> worker_ems;
+    std::vector<const Embedding*> worker_em(num_threads, &_em);
+    if (num_threads > 1) {
+        for (int i = 0; i < num_threads; ++i) {
+            worker_inputs.emplace_back(_em.embedding_input());
+            worker_ems.emplace_back(_em, worker_inputs.back());
+            worker_em[i] = &worker_ems.back();
         }
+    }
 
-        auto c = q.top();
-        q.pop();
+    // Per-worker materialized states. The root state (hash 0) is always available.
+    // Only accessed by the owning worker.
+    std::deque<EmbeddingState> worker_root_states;
+    std::deque<EmbeddingStateCache> worker_caches;
+    for (int i = 0; i < num_threads; ++i) {
+        worker_root_states.emplace_back(*worker_em[i], _settings);
+        worker_caches.emplace_back(_settings.state_cache_size);
+    }
 
-        // Early-out based on lower bound cached in c.
-        double gap = 1.0 - c.lower_bound / global_upper_bound;
-        if (gap <= _settings.optimality_gap) {
-            continue;
+    // Shared search state.
+    // q, known_states, best_insertion_sequence, result and the members below are guarded by mutex.
+    std::mutex mutex;
+    std::condition_variable cv;
+    int num_busy_workers = 0;
+    bool terminate = false;
+    std::exception_ptr worker_exception;
+    std::vector<double> in_flight_lower_bounds(num_threads, std::numeric_limits<double>::infinity());
+    std::vector<HashValue> in_flight_states(num_threads, 0); // Only meaningful if the lower bound above is finite
+
+    // Memory-bounded search (see BranchAndBoundSettings::SearchStrategy).
+    // Lower bounds of dropped states are kept so the reported lower bound remains valid.
+    double beam_dropped_lower_bound = std::numeric_limits<double>::infinity();
+    std::unordered_map<HashValue, Candidate> forgotten_children; // Per parent: Minimum over its dropped children
+    std::vector<HashValue> dead_ends; // Expanded states without children. Only kept for duplicate detection, evicted first.
+    bool search_limits_reached = false;
+
+    // States that could not be stored because a different state with the same hash is known (see verify_state_hashes).
+    // Their lower bounds are kept so the reported lower bound remains valid.
+    double collided_lower_bound = std::numeric_limits<double>::infinity();
+    auto report_hash_collision = [&](const double _lower_bound) {
+        if (result.num_hash_collisions == 0) {
+            std::cout << "Warning: State hash collision detected." << std::endl;
         }
-
-        // Reconstruct the embedding sequence and inserted paths by traversing the state graph
-        InsertionSequence insertion_sequence;
-        std::vector<const VirtualPath*> inserted_paths;
-        HashValue current_state_hash = c.state_hash;
-        while (current_state_hash != 0) {
-            LE_ASSERT_G(known_states.count(current_state_hash), 0);
-            const State& state = known_states[current_state_hash];
-            insertion_sequence.push_back(state.l_e);
-            inserted_paths.push_back(&state.path);
-            current_state_hash = state.parent;
+        ++result.num_hash_collisions;
+        collided_lower_bound = std::min(collided_lower_bound, _lower_bound);
+    };
+
+    auto min_dropped_lower_bound = [&]() {
+        double min_lower_bound = std::min(beam_dropped_lower_bound, collided_lower_bound);
+        for (const auto& [parent, forgotten] : forgotten_children) {
+            min_lower_bound = std::min(min_lower_bound, forgotten.lower_bound);
         }
-        std::reverse(insertion_sequence.begin(), insertion_sequence.end());
-        std::reverse(inserted_paths.begin(), inserted_paths.end());
+        return min_lower_bound;
+    };
 
-        // Reconstruct the embedding associated with this state
-        EmbeddingState es(_em, _settings);
-        LE_ASSERT_EQ(insertion_sequence.size(), inserted_paths.size());
-        for (size_t i = 0; i < insertion_sequence.size(); ++i) {
-            const pm::edge_index& l_e = insertion_sequence[i];
-            const VirtualPath& path = *inserted_paths[i];
-            es.extend(l_e, path);
+    auto is_in_flight = [&](const HashValue _hash) {
+        for (int i = 0; i < num_threads; ++i) {
+            if (!std::isinf(in_flight_lower_bounds[i]) && in_flight_states[i] == _hash) {
+                return true;
+            }
         }
-
-        LE_ASSERT_EQ(es.hash(), c.state_hash);
-
-        // Reconstruct candidate paths
-        auto& state = known_states[c.state_hash];
-        es.candidate_paths.clear();
-        for (const auto l_e : es.em.layout_mesh().edges()) {
-            es.candidate_paths[l_e] = state.candidate_paths[l_e.idx.value];
+        return false;
+    };
+
+    // A state whose children are all gone is either re-queued with the backed up bound of its
+    // forgotten children (memory-bounded search), or it is a dead end that can be evicted.
+    // Requires the mutex to be locked.
+    auto handle_childless = [&](const HashValue _hash, std::vector<Candidate>& _requeued) {
+        if (_settings.search_strategy == BranchAndBoundSettings::SearchStrategy::BestFirst) {
+            return;
+        }
+        if (_hash == 0 || !known_states.contains(_hash) || !known_states.children(_hash).empty() || is_in_flight(_hash)) {
+            return;
+        }
+        auto it = forgotten_children.find(_hash);
+        if (it != forgotten_children.end()) {
+            _requeued.push_back(it->second);
+            forgotten_children.erase(it);
+        }
+        else {
+            dead_ends.push_back(_hash);
+        }
+    };
+
+    // Entries that are temporarily taken out of the queue are passed as _num_set_aside.
+    auto exceeds_search_limits = [&](const double _fraction, const size_t _num_set_aside = 0) {
+        return (_settings.max_queue_size > 0 && q.size() + _num_set_aside > _fraction * _settings.max_queue_size)
+            || (_settings.max_num_states > 0 && known_states.size() > _fraction * _settings.max_num_states);
+    };
+
+    // Drops the worst leaves until the limits are met again (with some slack, so this does not happen every iteration).
+    // Requires the mutex to be locked.
+    auto enforce_search_limits = [&]() {
+        if (_settings.search_strategy == BranchAndBoundSettings::SearchStrategy::BestFirst || !exceeds_search_limits(1.0)) {
+            return;
+        }
+        if (!search_limits_reached) {
+            std::cout << "Search limits reached. Dropping the worst states from now on." << std::endl;
+            search_limits_reached = true;
         }
 
-        // Reconstruct candidate conflicts
-        es.conflicts = state.candidate_conflicts;
+        auto& container = get_container(q);
+        std::sort(container.begin(), container.end(), [](const Candidate& _a, const Candidate& _b) {
+            return _a.priority < _b.priority;
+        });
 
-        if (!es.valid()) {
-            // The current embedding might be invalid if paths run into dead ends.
-            // We ignore such states.
-            continue;
-        }
+        std::vector<Candidate> requeued_parents;
+        const double target_fraction = 0.9;
 
-        if (c.lower_bound > 0) {
-            // TODO
-            //LE_ASSERT_EQ(es.cost_lower_bound(), c.lower_bound);
+        // Evict dead ends first. They are not part of the frontier, so no lower bound is lost.
+        while (!dead_ends.empty() && exceeds_search_limits(target_fraction)) {
+            const HashValue hash = dead_ends.back();
+            dead_ends.pop_back();
+            if (!known_states.contains(hash) || !known_states.children(hash).empty() || is_in_flight(hash)) {
+                continue; // Outdated
+            }
+            const HashValue parent = known_states.parent(hash);
+            known_states.remove(hash);
+            handle_childless(parent, requeued_parents);
         }
 
-        // Cache classified edges
-        const auto& es_embedded_edges = es.embedded_edges();
-        const auto& es_conflicting_edges = es.conflicting_edges();
-        const auto& es_non_conflicting_edges = es.non_conflicting_edges();
-
-        std::cout << "t: " << timer.elapsedSecondsD();
-        std::cout << "    ";
-        std::cout << "global UB: " << global_upper_bound;
-        std::cout << "    ";
-        std::cout << "local LB: " << es.cost_lower_bound();
-        std::cout << "    ";
-        std::cout << "local gap: " << (gap * 100.0) << " %";
-        std::cout << "    ";
-        std::cout << "|Embd|: " << es_embedded_edges.size();
-        std::cout << "    ";
-        std::cout << "|Conf|: " << es_conflicting_edges.size();
-        std::cout << "    ";
-        std::cout << "|Ncnf|: " << es_non_conflicting_edges.size();
-        std::cout << "    ";
-        std::cout << "|Q|: " << q.size();
-        std::cout << "    ";
-        std::cout << "|H|: " << known_states.size();
-        if (_settings.print_current_insertion_sequence) {
-            std::cout << "    ";
-            std::cout << "s: ";
-            for (const auto& label : insertion_sequence) {
-                std::cout << label.value << " ";
+        std::vector<Candidate> kept; // Queue entries that can't be dropped
+        while (!container.empty() && exceeds_search_limits(target_fraction, kept.size())) {
+            const Candidate worst = container.back();
+            container.pop_back();
+
+            const HashValue hash = worst.state_hash;
+            if (hash == 0 || !known_states.children(hash).empty() || is_in_flight(hash)) {
+                // Can't be removed from the state tree. Dropping it from the queue only helps with the queue limit.
+                // Memory-bounded search never drops such an entry (in particular not the root).
+                const bool exceeds_queue_limit = _settings.max_queue_size > 0 && q.size() + kept.size() > target_fraction * _settings.max_queue_size;
+                if (_settings.search_strategy == BranchAndBoundSettings::SearchStrategy::MemoryBounded || !exceeds_queue_limit) {
+                    kept.push_back(worst);
+                }
+                else {
+                    beam_dropped_lower_bound = std::min(beam_dropped_lower_bound, worst.lower_bound);
+                }
+                continue;
             }
-        }
-        std::cout << std::endl;
 
-        if (_settings.record_lower_bound_events && !q.empty()) {
-            double min_lower_bound = std::numeric_limits<double>::infinity();
-            for (const auto& q_item : get_container(q)) {
-                min_lower_bound = std::min(min_lower_bound, q_item.lower_bound);
+            HashValue parent = known_states.parent(hash);
+            known_states.remove(hash);
+
+            if (_settings.search_strategy == BranchAndBoundSettings::SearchStrategy::MemoryBounded) {
+                // Back up the bound of the dropped leaf to its parent.
+                auto it = forgotten_children.find(hash);
+                if (it != forgotten_children.end()) {
+                    // The dropped state was a re-queued parent itself
+                    forgotten_children.erase(it);
+                }
+                auto [f_it, inserted] = forgotten_children.try_emplace(parent, worst);
+                auto& forgotten = f_it->second;
+                forgotten.state_hash = parent;
+                forgotten.lower_bound = std::min(forgotten.lower_bound, worst.lower_bound);
+                forgotten.priority = std::min(forgotten.priority, worst.priority);
+
+                // Once all children are gone, the parent has to be expanded again eventually.
+                if (known_states.children(parent).empty() && !is_in_flight(parent)) {
+                    requeued_parents.push_back(forgotten);
+                    forgotten_children.erase(parent);
+                }
             }
-            min_lower_bound = std::min(min_lower_bound, global_upper_bound);
-
-            // Only record this event if it's an update
-            if (!result.lower_bound_events.empty()) {
-                const auto& last_lower_bound = result.lower_bound_events.back();
-                if (min_lower_bound > last_lower_bound.lower_bound) { // Don't save redundant lower bound updates
-                    BranchAndBoundResult::LowerBoundEvent event;
-                    event.t = timer.elapsedSecondsD();
-                    event.lower_bound = min_lower_bound;
-                    result.lower_bound_events.push_back(event);
+            else {
+                beam_dropped_lower_bound = std::min(beam_dropped_lower_bound, worst.lower_bound);
+
+                // Remove ancestors that have become dead ends
+                while (parent != 0 && known_states.children(parent).empty() && !is_in_flight(parent)) {
+                    const HashValue grandparent = known_states.parent(parent);
+                    known_states.remove(parent);
+                    parent = grandparent;
                 }
             }
         }
 
-        if (_settings.print_memory_footprint_estimate) {
-            if (iter % 50 == 0) {
-                // Memory estimate
-                double estimated_memory;
+        for (const auto& k : kept) {
+            container.push_back(k);
+        }
+        for (const auto& requeued_parent : requeued_parents) {
+            container.push_back(requeued_parent);
+        }
+        std::make_heap(container.begin(), container.end(), std::less<Candidate>());
+    };
+
+    // Lower bounds evaluated for new states, cheapest first.
+    std::vector<BranchAndBoundSettings::LowerBound> lower_bounds = { BranchAndBoundSettings::LowerBound::CandidatePaths };
+    for (const auto& lb : _settings.additional_lower_bounds) {
+        if (lb != BranchAndBoundSettings::LowerBound::CandidatePaths) {
+            lower_bounds.push_back(lb);
+        }
+    }
+    std::vector<std::vector<BranchAndBoundResult::LowerBoundStats>> worker_lower_bound_stats(num_threads);
+    for (auto& stats : worker_lower_bound_stats) {
+        stats.resize(lower_bounds.size());
+    }
 
-                // Estimate memory of queue
-                estimated_memory += q.size() * sizeof (Candidate);
+    int iter = 0;
 
-                // Estimate memory of state tree
-                for (const auto& [hash, state] : known_states) {
-                    estimated_memory += sizeof(hash);
-                    estimated_memory += sizeof(state);
+    #pragma omp parallel num_threads(num_threads)
+    {
+        const int worker = omp_get_thread_num();
+
+        while (true) {
+            Candidate c;
+            double gap;
+            InsertionSequence insertion_sequence;
+            HashValue base_state_hash = 0; // Closest ancestor that is materialized in this worker's cache
+            std::vector<VirtualPath> inserted_paths; // Paths inserted since the base state
+            std::vector<VirtualPath> state_candidate_paths;
+            ConflictGraph state_candidate_conflicts;
+            HashValue state_verification_hash = 0;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+
+                // Wait for work. If the queue is empty and no other worker is expanding a state,
+                // no new candidates can appear and the search is finished.
+                cv.wait(lock, [&] { return terminate || !q.empty() || num_busy_workers == 0; });
+                if (terminate || q.empty()) {
+                    terminate = true;
+                    cv.notify_all();
+                    break;
+                }
 
-                    for (const auto& item : state.children) {
-                        estimated_memory += sizeof(item);
-                    }
-                    for (const auto& item : state.path) {
-                        estimated_memory += sizeof(item);
-                    }
-                    for (const auto& path : state.candidate_paths) {
-                        for (const auto& item : path) {
-                            estimated_memory += sizeof(item);
+                ++iter;
+
+                // Time limit
+                if (_settings.time_limit > 0.0) {
+                    if (timer.elapsedSecondsD() >= _settings.time_limit) {
+                        std::cout << "Reached time limit of " << _settings.time_limit << " s. Terminating." << std::endl;
+                        if (std::isinf(global_upper_bound.load())) {
+                            std::cout << "Warning: No valid solution was found within that time." << std::endl;
                         }
-                    }
-                    for (const auto& pair : state.candidate_conflicts) {
-                        estimated_memory += sizeof(pair);
+                        terminate = true;
+                        cv.notify_all();
+                        break;
                     }
                 }
 
-                result.max_state_tree_memory_estimate = std::max(result.max_state_tree_memory_estimate, estimated_memory);
+                c = q.top();
+                q.pop();
 
-                std::cout << "State tree memory estimate: ";
-                if (estimated_memory > 1000000000.0) {
-                    std::cout << (estimated_memory / 1000000000.0) << " GB";
-                }
-                else if (estimated_memory > 1000000.0) {
-                    std::cout << (estimated_memory / 1000000.0) << " MB";
-                }
-                else if (estimated_memory > 1000.0) {
-                    std::cout << (estimated_memory / 1000.0) << " kB";
+                // Early-out based on lower bound cached in c.
+                gap = 1.0 - c.lower_bound / global_upper_bound;
+                if (gap <= _settings.optimality_gap) {
+                    std::vector<Candidate> requeued;
+                    handle_childless(c.state_hash, requeued);
+                    for (const auto& r : requeued) {
+                        q.push(r);
+                    }
+                    continue;
                 }
-                else {
-                    std::cout << (estimated_memory) << " B";
+
+                // Reconstruct the embedding sequence by traversing the state graph.
+                // Paths are only needed up to the closest cached ancestor.
+                bool base_state_found = false;
+                HashValue current_state_hash = c.state_hash;
+                while (current_state_hash != 0) {
+                    if (!base_state_found && worker_caches[worker].contains(current_state_hash)) {
+                        base_state_hash = current_state_hash;
+                        base_state_found = true;
+                    }
+                    LE_ASSERT(known_states.contains(current_state_hash));
+                    insertion_sequence.push_back(known_states.inserted_edge(current_state_hash));
+                    if (!base_state_found) {
+                        inserted_paths.push_back(known_states.inserted_path(current_state_hash));
+                    }
+                    current_state_hash = known_states.parent(current_state_hash);
                 }
-                std::cout << std::endl;
-            }
-        }
+                std::reverse(insertion_sequence.begin(), insertion_sequence.end());
+                std::reverse(inserted_paths.begin(), inserted_paths.end());
 
-        if (es.cost_lower_bound() < global_upper_bound) {
-            std::set<pm::edge_index> insertion_options;
-            if (_settings.use_proactive_pruning) {
-                insertion_options = es_conflicting_edges;
-            }
-            else {
-                insertion_options = es.unembedded_edges();
+                state_candidate_paths = known_states.candidate_paths(c.state_hash);
+                state_candidate_conflicts = known_states.candidate_conflicts(c.state_hash);
+                state_verification_hash = known_states.verification_hash(c.state_hash);
+
+                ++num_busy_workers;
+                in_flight_lower_bounds[worker] = c.lower_bound;
+                in_flight_states[worker] = c.state_hash;
             }
 
-            // Completed layout?
-            if (insertion_options.empty()) {
-                global_upper_bound = es.cost_lower_bound();
-                best_insertion_sequence = insertion_sequence;
-                std::cout << "New upper bound: " << global_upper_bound << std::endl;
-                if (_settings.record_upper_bound_events) {
-                    BranchAndBoundResult::UpperBoundEvent event;
-                    event.t = timer.elapsedSecondsD();
-                    event.upper_bound = global_upper_bound;
-                    result.upper_bound_events.push_back(event);
+            // Marks the popped candidate as done and wakes up idle workers.
+            auto finish_candidate = [&]() {
+                std::lock_guard<std::mutex> lock(mutex);
+                --num_busy_workers;
+                in_flight_lower_bounds[worker] = std::numeric_limits<double>::infinity();
+                std::vector<Candidate> requeued;
+                handle_childless(c.state_hash, requeued);
+                for (const auto& r : requeued) {
+                    q.push(r);
+                }
+                enforce_search_limits();
+                cv.notify_all();
+            };
+
+            try {
+                // Reconstruct the embedding associated with this state,
+                // starting from the closest materialized ancestor.
+                const EmbeddingState& base_es = (base_state_hash == 0) ? worker_root_states[worker] : worker_caches[worker].get(base_state_hash);
+                auto es_ptr = std::make_unique<EmbeddingState>(base_es); // Copy
+                EmbeddingState& es = *es_ptr;
+                LE_ASSERT_GEQ(insertion_sequence.size(), inserted_paths.size());
+                const size_t num_base_insertions = insertion_sequence.size() - inserted_paths.size();
+                LE_ASSERT_EQ(es.insertion_sequence.size(), num_base_insertions);
+                for (size_t i = 0; i < inserted_paths.size(); ++i) {
+                    const pm::edge_index& l_e = insertion_sequence[num_base_insertions + i];
+                    const VirtualPath& path = inserted_paths[i];
+                    es.extend(l_e, path);
                 }
-            }
-            else {
-                // Add children to the queue
-                for (const auto& l_e : insertion_options) {
-                    if (es.candidate_paths[l_e].empty()) {
-                        continue;
-                    }
 
-                    EmbeddingState new_es(es); // Copy
+                LE_ASSERT_EQ(es.hash(), c.state_hash);
+                if (_settings.verify_state_hashes) {
+                    LE_ASSERT_EQ(es.hash(), es.recompute_hash());
+                    LE_ASSERT_EQ(es.verification_hash(), state_verification_hash);
+                }
+
+                // Reconstruct candidate paths
+                es.set_candidate_paths(state_candidate_paths);
 
-                    // Update new state by adding the new child halfedge
-                    new_es.extend(l_e, es.candidate_paths[l_e]);
+                // Reconstruct candidate conflicts
+                es.conflicts = state_candidate_conflicts;
 
-                    // Early-out if the resulting state is already known
-                    const HashValue new_es_hash = new_es.hash();
+                if (!es.valid()) {
+                    // The current embedding might be invalid if paths run into dead ends.
+                    // We ignore such states.
+                    finish_candidate();
+                    continue;
+                }
 
-                    // TODO: re-enable? remove?
-                    //if (_settings.use_state_hashing) {
-                    if (known_states.count(new_es_hash)) {
-                        continue;
+                if (c.lower_bound > 0) {
+                    // TODO
+                    //LE_ASSERT_EQ(es.cost_lower_bound(), c.lower_bound);
+                }
+
+                // Cache classified edges
+                const auto& es_embedded_edges = es.embedded_edges();
+                const auto& es_conflicting_edges = es.conflicting_edges();
+                const auto& es_non_conflicting_edges = es.non_conflicting_edges();
+
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+
+                    std::cout << "t: " << timer.elapsedSecondsD();
+                    std::cout << "    ";
+                    std::cout << "global UB: " << global_upper_bound.load();
+                    std::cout << "    ";
+                    std::cout << "local LB: " << es.cost_lower_bound();
+                    std::cout << "    ";
+                    std::cout << "local gap: " << (gap * 100.0) << " %";
+                    std::cout << "    ";
+                    std::cout << "|Embd|: " << es_embedded_edges.size();
+                    std::cout << "    ";
+                    std::cout << "|Conf|: " << es_conflicting_edges.size();
+                    std::cout << "    ";
+                    std::cout << "|Ncnf|: " << es_non_conflicting_edges.size();
+                    std::cout << "    ";
+                    std::cout << "|Q|: " << q.size();
+                    std::cout << "    ";
+                    std::cout << "|H|: " << known_states.size();
+                    if (num_threads > 1) {
+                        std::cout << "    ";
+                        std::cout << "worker: " << worker;
+                    }
+                    if (_settings.print_current_insertion_sequence) {
+                        std::cout << "    ";
+                        std::cout << "s: ";
+                        for (const auto& label : insertion_sequence) {
+                            std::cout << label.value << " ";
+                        }
                     }
-                    //}
+                    std::cout << std::endl;
 
-                    // Update candidate paths that were in conflict with the newly inserted edge
-                    for (const auto& l_e_conflicting : new_es.get_conflicting_candidates(l_e)) {
-                        new_es.compute_candidate_path(l_e_conflicting);
+                    if (_settings.record_lower_bound_events && !q.empty()) {
+                        double min_lower_bound = std::numeric_limits<double>::infinity();
+                        for (const auto& q_item : get_container(q)) {
+                            min_lower_bound = std::min(min_lower_bound, q_item.lower_bound);
+                        }
+                        // States that are currently being expanded by other workers still count.
+                        for (const auto& in_flight_lower_bound : in_flight_lower_bounds) {
+                            min_lower_bound = std::min(min_lower_bound, in_flight_lower_bound);
+                        }
+                        // So do states that were dropped by memory-bounded search.
+                        min_lower_bound = std::min(min_lower_bound, min_dropped_lower_bound());
+                        min_lower_bound = std::min(min_lower_bound, global_upper_bound.load());
+
+                        // Only record this event if it's an update
+                        if (!result.lower_bound_events.empty()) {
+                            const auto& last_lower_bound = result.lower_bound_events.back();
+                            if (min_lower_bound > last_lower_bound.lower_bound) { // Don't save redundant lower bound updates
+                                BranchAndBoundResult::LowerBoundEvent event;
+                                event.t = timer.elapsedSecondsD();
+                                event.lower_bound = min_lower_bound;
+                                result.lower_bound_events.push_back(event);
+                            }
+                        }
                     }
 
-                    // Pruning
-                    const double new_lower_bound = new_es.cost_lower_bound();
-                    const double new_gap = 1.0 - new_lower_bound / global_upper_bound;
-                    if (new_gap < _settings.optimality_gap) {
-                        continue;
+                    if (_settings.print_memory_footprint_estimate) {
+                        if (iter % 50 == 0) {
+                            // Memory estimate
+                            double estimated_memory = 0.0;
+
+                            // Estimate memory of queue
+                            estimated_memory += q.size() * sizeof (Candidate);
+
+                            // Estimate memory of state tree
+                            estimated_memory += known_states.memory_estimate();
+
+                            result.max_state_tree_memory_estimate = std::max(result.max_state_tree_memory_estimate, estimated_memory);
+
+                            std::cout << "State tree memory estimate: ";
+                            if (estimated_memory > 1000000000.0) {
+                                std::cout << (estimated_memory / 1000000000.0) << " GB";
+                            }
+                            else if (estimated_memory > 1000000.0) {
+                                std::cout << (estimated_memory / 1000000.0) << " MB";
+                            }
+                            else if (estimated_memory > 1000.0) {
+                                std::cout << (estimated_memory / 1000.0) << " kB";
+                            }
+                            else {
+                                std::cout << (estimated_memory) << " B";
+                            }
+                            std::cout << std::endl;
+                        }
                     }
+                }
 
-                    // Recompute all conflicts
-                    new_es.detect_candidate_path_conflicts();
-
-                    // Create a new state
-                    State new_state;
-                    new_state.parent = c.state_hash;
-                    new_state.l_e = l_e;
-                    new_state.path = es.candidate_paths[l_e];
-                    new_state.candidate_paths = new_es.candidate_paths.to_vector();
-                    new_state.candidate_conflicts = new_es.conflicts;
-
-                    // Save the new state
-                    known_states.emplace(new_es_hash, new_state);
-                    state.children.push_back(new_es_hash);
-
-                    // Insert a corresponding element into the queue
-                    Candidate new_c;
-                    new_c.state_hash = new_es_hash;
-                    new_c.lower_bound = new_lower_bound;
-                    if (_settings.priority == BranchAndBoundSettings::Priority::LowerBoundNonConflicting) {
-                        new_c.priority = new_c.lower_bound * new_es.conflicting_edges().size();
+                if (es.cost_lower_bound() < global_upper_bound) {
+                    std::vector<pm::edge_index> insertion_options;
+                    if (_settings.use_proactive_pruning) {
+                        insertion_options = es_conflicting_edges;
+                    }
+                    else {
+                        insertion_options = es.unembedded_edges();
                     }
-                    else if (_settings.priority == BranchAndBoundSettings::Priority::LowerBound) {
-                        new_c.priority = new_c.lower_bound;
+
+                    // Completed layout?
+                    if (insertion_options.empty()) {
+                        const double cost = es.cost_lower_bound();
+
+                        std::lock_guard<std::mutex> lock(mutex);
+                        // Another worker might have found a better solution in the meantime.
+                        if (cost < global_upper_bound) {
+                            global_upper_bound = cost;
+                            best_insertion_sequence = insertion_sequence;
+                            std::cout << "New upper bound: " << global_upper_bound.load() << std::endl;
+                            if (_settings.record_upper_bound_events) {
+                                BranchAndBoundResult::UpperBoundEvent event;
+                                event.t = timer.elapsedSecondsD();
+                                event.upper_bound = global_upper_bound;
+                                result.upper_bound_events.push_back(event);
+                            }
+                        }
                     }
                     else {
-                        LE_ASSERT(false);
+                        // Children are expanded without holding the lock and committed in one go afterwards.
+                        struct Child
+                        {
+                            HashValue hash;
+                            HashValue verification_hash;
+                            pm::edge_index l_e;
+                            VirtualPath path;
+                            StateTree::EncodedCandidates candidates;
+                            Candidate candidate;
+                        };
+                        std::vector<Child> children;
+
+                        // Evaluates the child in which _l_e is inserted along _path.
+                        // es is extended tentatively and rolled back by the caller.
+                        auto evaluate_child = [&](const pm::edge_index& _l_e, const VirtualPath& _path, Child& _child) {
+                            // Update state by adding the new child halfedge
+                            es.extend(_l_e, _path);
+
+                            // Whether the resulting state is already known is checked once when the children are committed,
+                            // so the global lock is only taken once per expanded state.
+                            const HashValue new_es_hash = es.hash();
+                            const HashValue new_es_verification_hash = _settings.verify_state_hashes ? es.verification_hash() : 0;
+
+                            // Update candidate paths that were in conflict with the newly inserted edge
+                            es.compute_candidate_paths(es.get_conflicting_candidates(_l_e));
+
+                            // Evaluates the i-th lower bound and returns false if the child can be pruned.
+                            double new_lower_bound = 0.0;
+                            auto apply_lower_bound = [&](const int _i) {
+                                auto& stats = worker_lower_bound_stats[worker][_i];
+                                glow::timing::CpuTimer lb_timer;
+                                new_lower_bound = std::max(new_lower_bound, compute_lower_bound(es, lower_bounds[_i]));
+                                stats.time += lb_timer.elapsedSecondsD();
+                                ++stats.num_evaluations;
+
+                                const double new_gap = 1.0 - new_lower_bound / global_upper_bound;
+                                if (new_gap < _settings.optimality_gap) {
+                                    ++stats.num_prunes;
+                                    return false;
+                                }
+                                return true;
+                            };
+
+                            // Pruning
+                            if (!apply_lower_bound(0)) {
+                                return false;
+                            }
+
+                            // Update conflicts of the changed paths
+                            es.detect_candidate_path_conflicts();
+
+                            // More expensive bounds depend on the conflicts
+                            for (int i = 1; i < (int)lower_bounds.size(); ++i) {
+                                if (!apply_lower_bound(i)) {
+                                    return false;
+                                }
+                            }
+
+                            // Create a new state
+                            _child.hash = new_es_hash;
+                            _child.verification_hash = new_es_verification_hash;
+                            _child.l_e = _l_e;
+                            _child.path = _path;
+                            _child.candidates = StateTree::encode(es.candidate_paths.to_vector(), state_candidate_paths, es.conflicts);
+
+                            // Prepare a corresponding element for the queue
+                            _child.candidate.state_hash = new_es_hash;
+                            _child.candidate.lower_bound = new_lower_bound;
+                            if (_settings.priority == BranchAndBoundSettings::Priority::LowerBoundNonConflicting) {
+                                _child.candidate.priority = _child.candidate.lower_bound * es.num_conflicting_edges();
+                            }
+                            else if (_settings.priority == BranchAndBoundSettings::Priority::LowerBound) {
+                                _child.candidate.priority = _child.candidate.lower_bound;
+                            }
+                            else {
+                                LE_ASSERT(false);
+                            }
+                            return true;
+                        };
+
+                        // Bring the conflict sentinel up to date (usually only the replayed insertions have to be applied).
+                        // Each child then only updates the paths that changed.
+                        es.detect_candidate_path_conflicts();
+
+                        // Instead of copying the whole state for each child, extend it in place and roll back afterwards.
+                        const auto es_cp = es.checkpoint();
+                        for (const auto& l_e : insertion_options) {
+                            if (es.candidate_paths[l_e].empty()) {
+                                continue;
+                            }
+
+                            const VirtualPath path = es.candidate_paths[l_e]; // Copy, candidate paths change during evaluation
+                            Child child;
+                            if (evaluate_child(l_e, path, child)) {
+                                children.push_back(std::move(child));
+                            }
+                            es.rollback(es_cp);
+                        }
+                        es.commit(es_cp);
+
+                        {
+                            std::lock_guard<std::mutex> lock(mutex);
+                            for (auto& child : children) {
+                                // Already known, e.g. reached by another worker or via another insertion order.
+                                if (known_states.contains(child.hash)) {
+                                    if (_settings.verify_state_hashes && known_states.verification_hash(child.hash) != child.verification_hash) {
+                                        report_hash_collision(child.candidate.lower_bound);
+                                    }
+                                    continue;
+                                }
+
+                                // The upper bound might have improved in the meantime.
+                                const double new_gap = 1.0 - child.candidate.lower_bound / global_upper_bound;
+                                if (new_gap < _settings.optimality_gap) {
+                                    continue;
+                                }
+
+                                // Save the new state and insert it into the queue
+                                known_states.insert(child.hash, c.state_hash, child.l_e, child.path, std::move(child.candidates), child.verification_hash);
+                                q.push(child.candidate);
+                            }
+                        }
+
+                        // Keep this state materialized. Its children are likely to be popped soon.
+                        if (!children.empty()) {
+                            worker_caches[worker].insert(c.state_hash, std::move(es_ptr));
+                        }
                     }
-                    q.push(new_c);
                 }
             }
+            catch (...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!worker_exception) {
+                    worker_exception = std::current_exception();
+                }
+                terminate = true;
+            }
+
+            finish_candidate();
         }
     }
+
+    if (worker_exception) {
+        std::rethrow_exception(worker_exception);
+    }
+
     std::cout << "Branch-and-bound optimization completed." << std::endl;
     result.insertion_sequence = best_insertion_sequence;
     result.num_iters = iter;
 
+    for (int i = 0; i < (int)lower_bounds.size(); ++i) {
+        BranchAndBoundResult::LowerBoundStats stats;
+        stats.name = lower_bound_name(lower_bounds[i]);
+        for (const auto& worker_stats : worker_lower_bound_stats) {
+            stats.num_evaluations += worker_stats[i].num_evaluations;
+            stats.num_prunes += worker_stats[i].num_prunes;
+            stats.time += worker_stats[i].time;
+        }
+        std::cout << "Lower bound " << stats.name << ": "
+                  << stats.num_evaluations << " evaluations, "
+                  << stats.num_prunes << " prunes, "
+                  << stats.time << " s" << std::endl;
+        result.lower_bound_stats.push_back(stats);
+    }
+
     {
         // Drain the rest of the queue to find the maximum optimality gap
-        auto final_lower_bound = std::numeric_limits<double>::infinity();
-        auto final_gap = 1.0;
+        // States dropped by memory-bounded search also count.
+        auto final_lower_bound = min_dropped_lower_bound();
+        auto final_gap = 1.0 - final_lower_bound / global_upper_bound;
         while (!q.empty()) {
             auto c = q.top();
             final_lower_bound = std::min(final_lower_bound, c.lower_bound);
@@ -378,7 +786,7 @@ BranchAndBoundResult branch_and_bound(Embedding& _em, const BranchAndBoundSettin
         result.gap = final_gap;
     }
 
-    if (std::isinf(global_upper_bound)) {
+    if (std::isinf(global_upper_bound.load())) {
         result.cost = global_upper_bound;
         result.insertion_sequence.clear();
     }
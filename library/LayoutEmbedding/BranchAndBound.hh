@@ -20,14 +20,52 @@ struct BranchAndBoundSettings
     };
     Priority priority = Priority::LowerBoundNonConflicting;
 
+    enum class LowerBound
+    {
+        CandidatePaths,  // Embedded length + lengths of the independent candidate shortest paths. Always evaluated first.
+        ConflictReroute, // Minimum over the conflicting edges X of the candidate path bound after inserting X:
+                         // The candidates conflicting with X have to be rerouted around it.
+                         // One shortest path search per conflict. Requires use_proactive_pruning, otherwise it equals CandidatePaths.
+    };
+    // Additional lower bounds, evaluated in order (after conflict detection) for new states that survive the previous ones.
+    // The maximum of all bounds is used.
+    std::vector<LowerBound> additional_lower_bounds;
+
     bool use_state_hashing = true;
+    bool verify_state_hashes = false; // Compare a second, independent fingerprint whenever a state is already known. Collisions are reported instead of silently pruning the state.
     bool use_proactive_pruning = true;
     bool use_candidate_paths_for_lower_bounds = true;
+    bool use_parallel_candidate_paths = true; // Compute independent candidate paths with OpenMP. Only effective outside of parallel regions (e.g. num_threads == 1).
 
     bool print_current_insertion_sequence = true;
     bool print_memory_footprint_estimate = true;
 
     bool use_greedy_init = true;
+
+    enum class SearchStrategy
+    {
+        BestFirst,     // Unbounded best-first search. The limits below are ignored.
+        MemoryBounded, // SMA*-style: If a limit is exceeded, the worst leaves are dropped and their lower bound is backed up to the parent, which is re-queued once all of its children are gone.
+        Beam,          // If a limit is exceeded, the worst leaves are dropped for good. The reported lower bound and gap still account for them.
+    };
+    SearchStrategy search_strategy = SearchStrategy::BestFirst;
+    int max_queue_size = 0; // Set to <= 0 to disable.
+    int max_num_states = 0; // Set to <= 0 to disable.
+    // Expanded states without children (dead ends) are evicted before any leaf is dropped.
+
+    // Number of worker threads that expand states concurrently.
+    // All workers share one priority queue, state tree, and global upper bound.
+    // Set to <= 0 to use all available cores.
+    int num_threads = 1;
+
+    // Number of expanded states each worker keeps materialized (as full EmbeddingState copies).
+    // A popped state is reconstructed from its closest cached ancestor instead of from the root.
+    // Set to 0 to always reconstruct from the root.
+    int state_cache_size = 8;
+
+    // Memory budget for the state tree (Bytes). Set to <= 0 to disable.
+    // When exceeded, candidate data of the least recently used states is spilled to a temporary file.
+    double state_tree_memory_budget = 0.0;
 };
 
 struct BranchAndBoundResult
@@ -62,6 +100,18 @@ struct BranchAndBoundResult
     };
     std::vector<LowerBoundEvent> lower_bound_events;
 
+    // Cost and pruning power of each lower bound (see BranchAndBoundSettings::LowerBound).
+    struct LowerBoundStats
+    {
+        std::string name;
+        int num_evaluations = 0;
+        int num_prunes = 0; // New states pruned because of this bound (and not an earlier one)
+        double time = 0.0; // Seconds, summed over all workers
+    };
+    std::vector<LowerBoundStats> lower_bound_stats;
+
+    int num_hash_collisions = 0; // Only detected if verify_state_hashes
+
     double max_state_tree_memory_estimate = 0.0; // Bytes
     int num_iters = 0;
 };
@@ -0,0 +1,118 @@
+#include "ConflictGraph.hh"
+
+#include <LayoutEmbedding/Util/Assert.hh>
+
+#include <algorithm>
+
+namespace LayoutEmbedding {
+
+ConflictGraph::ConflictGraph(int _num_edges) :
+    n(_num_edges),
+    words_per_row((_num_edges + 63) / 64),
+    bits((std::size_t)_num_edges * words_per_row, 0)
+{
+}
+
+void ConflictGraph::clear()
+{
+    std::fill(bits.begin(), bits.end(), 0);
+    num_pairs = 0;
+}
+
+void ConflictGraph::insert(const pm::edge_index& _a, const pm::edge_index& _b)
+{
+    LE_ASSERT_NEQ(_a.value, _b.value);
+    if (contains(_a, _b)) {
+        return;
+    }
+    row(_a.value)[_b.value / 64] |= uint64_t(1) << (_b.value % 64);
+    row(_b.value)[_a.value / 64] |= uint64_t(1) << (_a.value % 64);
+    ++num_pairs;
+}
+
+void ConflictGraph::erase(const pm::edge_index& _a, const pm::edge_index& _b)
+{
+    if (!contains(_a, _b)) {
+        return;
+    }
+    row(_a.value)[_b.value / 64] &= ~(uint64_t(1) << (_b.value % 64));
+    row(_b.value)[_a.value / 64] &= ~(uint64_t(1) << (_a.value % 64));
+    --num_pairs;
+}
+
+bool ConflictGraph::contains(const pm::edge_index& _a, const pm::edge_index& _b) const
+{
+    LE_ASSERT_GEQ(_a.value, 0);
+    LE_ASSERT_L(_a.value, n);
+    LE_ASSERT_GEQ(_b.value, 0);
+    LE_ASSERT_L(_b.value, n);
+    return (row(_a.value)[_b.value / 64] >> (_b.value % 64)) & 1;
+}
+
+int ConflictGraph::num_edges() const
+{
+    return n;
+}
+
+int ConflictGraph::num_conflicts() const
+{
+    return num_pairs;
+}
+
+bool ConflictGraph::empty() const
+{
+    return num_pairs == 0;
+}
+
+bool ConflictGraph::is_conflicting(const pm::edge_index& _e) const
+{
+    const uint64_t* r = row(_e.value);
+    return std::any_of(r, r + words_per_row, [](uint64_t _w) { return _w != 0; });
+}
+
+int ConflictGraph::num_conflicting_edges() const
+{
+    // Union of all rows
+    int result = 0;
+    std::vector<uint64_t> any(words_per_row, 0);
+    for (int a = 0; a < n; ++a) {
+        const uint64_t* r = row(a);
+        for (int w = 0; w < words_per_row; ++w) {
+            any[w] |= r[w];
+        }
+    }
+    for (const auto& w : any) {
+        result += __builtin_popcountll(w);
+    }
+    return result;
+}
+
+std::vector<pm::edge_index> ConflictGraph::neighbors(const pm::edge_index& _e) const
+{
+    std::vector<pm::edge_index> result;
+    for_each_bit(_e.value, 0, [&](int b) { result.push_back(pm::edge_index(b)); });
+    return result;
+}
+
+std::vector<pm::edge_index> ConflictGraph::conflicting_edges() const
+{
+    std::vector<pm::edge_index> result;
+    for (int a = 0; a < n; ++a) {
+        if (is_conflicting(pm::edge_index(a))) {
+            result.push_back(pm::edge_index(a));
+        }
+    }
+    return result;
+}
+
+bool ConflictGraph::operator==(const ConflictGraph& _rhs) const
+{
+    return n == _rhs.n && bits == _rhs.bits;
+}
+
+bool ConflictGraph::operator!=(const ConflictGraph& _rhs) const
+{
+    return !(*this == _rhs);
+}
+
+}
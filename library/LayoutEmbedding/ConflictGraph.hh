@@ -0,0 +1,76 @@
+#pragma once
+
+#include <polymesh/pm.hh>
+
+#include <cstdint>
+#include <vector>
+
+namespace LayoutEmbedding {
+
+/// Symmetric conflict relation among layout edges, stored as a dense adjacency bitset.
+/// Row i holds the edges that conflict with edge i. Classification and iteration are popcount / bit-scan based.
+class ConflictGraph
+{
+public:
+    ConflictGraph() = default;
+    explicit ConflictGraph(int _num_edges);
+
+    void clear(); // Removes all conflicts, keeps the number of edges
+
+    void insert(const pm::edge_index& _a, const pm::edge_index& _b);
+    void erase(const pm::edge_index& _a, const pm::edge_index& _b);
+    bool contains(const pm::edge_index& _a, const pm::edge_index& _b) const;
+
+    int num_edges() const;
+    int num_conflicts() const; // Number of conflicting pairs
+    bool empty() const;
+
+    bool is_conflicting(const pm::edge_index& _e) const; // Has at least one conflict
+    int num_conflicting_edges() const;
+
+    /// Edges conflicting with _e, in ascending order.
+    std::vector<pm::edge_index> neighbors(const pm::edge_index& _e) const;
+
+    /// Edges with at least one conflict, in ascending order.
+    std::vector<pm::edge_index> conflicting_edges() const;
+
+    /// Calls _f(a, b) for each conflicting pair with a < b, in lexicographic order.
+    template <typename F>
+    void for_each_conflict(F&& _f) const
+    {
+        for (int a = 0; a < n; ++a) {
+            for_each_bit(a, a + 1, [&](int b) { _f(pm::edge_index(a), pm::edge_index(b)); });
+        }
+    }
+
+    bool operator==(const ConflictGraph& _rhs) const;
+    bool operator!=(const ConflictGraph& _rhs) const;
+
+private:
+    uint64_t* row(int _a) { return bits.data() + (std::size_t)_a * words_per_row; }
+    const uint64_t* row(int _a) const { return bits.data() + (std::size_t)_a * words_per_row; }
+
+    // Calls _f(b) for each set bit b >= _begin in row _a.
+    template <typename F>
+    void for_each_bit(int _a, int _begin, F&& _f) const
+    {
+        const uint64_t* r = row(_a);
+        for (int w = _begin / 64; w < words_per_row; ++w) {
+            uint64_t word = r[w];
+            if (w == _begin / 64) {
+                word &= ~uint64_t(0) << (_begin % 64);
+            }
+            while (word != 0) {
+                _f(w * 64 + __builtin_ctzll(word));
+                word &= word - 1;
+            }
+        }
+    }
+
+    int n = 0;
+    int words_per_row = 0;
+    std::vector<uint64_t> bits;
+    int num_pairs = 0;
+};
+
+}
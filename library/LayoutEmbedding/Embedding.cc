@@ -2,10 +2,14 @@
 
 #include <LayoutEmbedding/Connectivity.hh>
 #include <LayoutEmbedding/VertexRepulsiveEnergy.hh>
-#include <LayoutEmbedding/VirtualVertexAttribute.hh>
+#include <LayoutEmbedding/ShortestPathLandmarks.hh>
+#include <LayoutEmbedding/ShortestPathWorkspace.hh>
 #include <LayoutEmbedding/Snake.hh>
 #include <LayoutEmbedding/Util/Assert.hh>
 
+#include <polymesh/low_level_api.hh>
+
+#include <algorithm>
 #include <queue>
 
 namespace LayoutEmbedding {
@@ -32,6 +36,8 @@ Embedding::Embedding(EmbeddingInput& _input) :
 
     for (auto l_v : layout_mesh().vertices())
         LE_ASSERT(!l_matching_vertex[l_v].is_boundary());
+
+    embedded_paths.resize(layout_mesh().all_edges().size());
 }
 
 Embedding::Embedding(const Embedding& _em)
@@ -39,9 +45,27 @@ Embedding::Embedding(const Embedding& _em)
     *this = _em;
 }
 
+Embedding::Embedding(const Embedding& _em, EmbeddingInput& _input)
+{
+    copy_from(_em, _input);
+}
+
 Embedding& Embedding::operator=(const Embedding& _em)
 {
-    input = _em.input;
+    if (&_em == this) {
+        return *this;
+    }
+    copy_from(_em, *_em.input);
+    return *this;
+}
+
+void Embedding::copy_from(const Embedding& _em, EmbeddingInput& _input)
+{
+    // _input has to be _em.input itself or an index-preserving copy of it.
+    LE_ASSERT_EQ(_input.l_m.all_vertices().size(), _em.layout_mesh().all_vertices().size());
+    LE_ASSERT_EQ(_input.l_m.all_halfedges().size(), _em.layout_mesh().all_halfedges().size());
+
+    input = &_input;
     t_m.copy_from(_em.t_m);
 
     t_pos = t_m.vertices().make_attribute<tg::pos3>();
@@ -53,51 +77,74 @@ Embedding& Embedding::operator=(const Embedding& _em)
     }
 
     t_matching_vertex = t_m.vertices().make_attribute<pm::vertex_handle>();
-    for (const auto t_v : target_mesh().vertices()) {
-        t_matching_vertex[t_v] = layout_mesh()[_em.t_matching_vertex[t_v.idx].idx];
+    t_matching_halfedge = t_m.halfedges().make_attribute<pm::halfedge_handle>();
+    if (&_em.layout_mesh() == &layout_mesh()) {
+        // The stored layout handles remain valid. Copy the attributes in bulk.
+        t_matching_vertex.copy_from(_em.t_matching_vertex);
+        t_matching_halfedge.copy_from(_em.t_matching_halfedge);
+    }
+    else {
+        // Rebind the stored layout handles to the new layout mesh.
+        for (const auto t_v : target_mesh().vertices()) {
+            t_matching_vertex[t_v] = layout_mesh()[_em.t_matching_vertex[t_v.idx].idx];
+        }
+        for (const auto t_he : target_mesh().halfedges()) {
+            t_matching_halfedge[t_he] = layout_mesh()[_em.t_matching_halfedge[t_he.idx].idx];
+        }
     }
 
-    t_matching_halfedge = t_m.halfedges().make_attribute<pm::halfedge_handle>();
-    for (const auto t_he : target_mesh().halfedges()) {
-        t_matching_halfedge[t_he] = layout_mesh()[_em.t_matching_halfedge[t_he.idx].idx];
+    if (_em.vertex_repulsive_energy_ready) {
+        vertex_repulsive_energy.emplace(*_em.vertex_repulsive_energy);
+    }
+    else {
+        vertex_repulsive_energy.reset();
     }
+    vertex_repulsive_energy_ready = vertex_repulsive_energy.has_value();
 
-    if (_em.vertex_repulsive_energy.has_value()) {
-        vertex_repulsive_energy = target_mesh().vertices().make_attribute<Eigen::VectorXd>();
-        vertex_repulsive_energy->copy_from(*_em.vertex_repulsive_energy);
+    sp_settings = _em.sp_settings;
+    {
+        std::lock_guard<std::mutex> lock(_em.landmarks_mutex);
+        landmarks = _em.landmarks;
     }
 
-    return *this;
+    // Target element indices are preserved by the copy
+    embedded_paths = _em.embedded_paths;
+    num_embedded_paths = _em.num_embedded_paths;
+    total_length = _em.total_length;
+
+    // The undo log is not copied
+    undo_log.clear();
+    undo_embedded_paths.clear();
+    recording = false;
 }
 
 pm::halfedge_handle Embedding::get_embedded_target_halfedge(const pm::halfedge_handle& _l_he) const
 {
     LE_ASSERT(_l_he.mesh == &layout_mesh());
-    const auto& l_v = _l_he.vertex_from();
-    const auto& t_v = l_matching_vertex[l_v];
-    LE_ASSERT(t_v.is_valid());
-    for (const auto t_h : t_v.outgoing_halfedges()) {
-        if (t_matching_halfedge[t_h] == _l_he) {
-            return t_h;
-        }
+    const auto& ep = embedded_paths[_l_he.edge().idx.value];
+    if (ep.vertices.empty()) {
+        return pm::halfedge_handle::invalid;
     }
-    return pm::halfedge_handle::invalid;
+    const auto t_h = target_mesh()[_l_he == _l_he.edge().halfedgeA() ? ep.t_h_A : ep.t_h_B];
+    LE_ASSERT(t_matching_halfedge[t_h] == _l_he);
+    return t_h;
 }
 
 bool Embedding::is_embedded(const pm::halfedge_handle& _l_he) const
 {
-    return get_embedded_target_halfedge(_l_he).is_valid();
+    LE_ASSERT(_l_he.mesh == &layout_mesh());
+    return is_embedded(_l_he.edge().idx);
 }
 
 bool Embedding::is_embedded(const pm::edge_handle& _l_e) const
 {
-    return is_embedded(_l_e.halfedgeA());
+    LE_ASSERT(_l_e.mesh == &layout_mesh());
+    return is_embedded(_l_e.idx);
 }
 
 bool Embedding::is_embedded(const pm::edge_index& _l_e) const
 {
-    const auto& l_e = layout_mesh()[_l_e];
-    return is_embedded(l_e);
+    return !embedded_paths[_l_e.value].vertices.empty();
 }
 
 pm::halfedge_handle Embedding::get_embeddable_sector(const pm::halfedge_handle& _l_he) const
@@ -266,37 +313,201 @@ tg::pos3 Embedding::element_pos(const VirtualVertex& _t_vv) const
     }
 }
 
-VirtualPath Embedding::find_shortest_path(const pm::halfedge_handle& _t_h_sector_start, const pm::halfedge_handle& _t_h_sector_end, ShortestPathMetric _metric) const
+const Embedding::ShortestPathSettings& Embedding::shortest_path_settings() const
 {
-    struct Distance
-    {
-        int edges_crossed = std::numeric_limits<int>::max();
-        double distance_from_source = std::numeric_limits<double>::infinity();
-        double remaining_distance_heuristic = 0.0; // Used for A* search
+    return sp_settings;
+}
 
-        bool operator<(const Distance& rhs) const
-        {
-            return distance_from_source + remaining_distance_heuristic < rhs.distance_from_source + rhs.remaining_distance_heuristic;
+void Embedding::set_shortest_path_settings(const ShortestPathSettings& _settings)
+{
+    LE_ASSERT_GEQ(_settings.max_num_landmarks, 1);
+    LE_ASSERT(_settings.max_num_vertex_repulsive_fields == 0 || _settings.max_num_vertex_repulsive_fields >= 2);
+    if (_settings.max_num_landmarks != sp_settings.max_num_landmarks) {
+        reset_landmarks();
+    }
+    if (_settings.max_num_vertex_repulsive_fields != sp_settings.max_num_vertex_repulsive_fields
+            || _settings.vertex_repulsive_solver != sp_settings.vertex_repulsive_solver) {
+        reset_vertex_repulsive_energy();
+    }
+    sp_settings = _settings;
+}
+
+std::shared_ptr<const ShortestPathLandmarks> Embedding::get_landmarks() const
+{
+    // Might be called concurrently from multiple threads
+    std::lock_guard<std::mutex> lock(landmarks_mutex);
+    if (!landmarks) {
+        // Refinements create shortcuts, so distances on the input target mesh would overestimate.
+        std::vector<pm::vertex_handle> t_candidates;
+        for (const auto l_v : layout_mesh().vertices()) {
+            t_candidates.push_back(matching_target_vertex(l_v));
         }
-    };
+        landmarks = std::make_shared<const ShortestPathLandmarks>(target_mesh(), t_pos, t_candidates, sp_settings.max_num_landmarks);
+    }
+    return landmarks;
+}
 
-    struct Candidate
-    {
-        VirtualVertex vv;
-        tg::pos3 p;
-        Distance dist;
+void Embedding::reset_landmarks()
+{
+    std::lock_guard<std::mutex> lock(landmarks_mutex);
+    landmarks.reset();
+}
 
-        bool operator>(const Candidate& rhs) const
-        {
-            return rhs.dist < dist; // reversed
+std::vector<VirtualVertex> Embedding::get_virtual_vertices_in_sector(const pm::halfedge_handle& t_he_sector) const
+{
+    auto t_he_sector_start = t_he_sector;
+    auto t_he_sector_end = t_he_sector;
+    t_he_sector_end = t_he_sector_end.prev().opposite(); // Rotate ccw
+    while (true) {
+        if (t_he_sector_start == t_he_sector_end) {
+            break;
+        }
+        if (!is_blocked(t_he_sector_start.edge())) {
+            t_he_sector_start = t_he_sector_start.opposite().next(); // Rotate cw
+        }
+        else if (!is_blocked(t_he_sector_end.edge())) {
+            t_he_sector_end = t_he_sector_end.prev().opposite(); // Rotate ccw
+        }
+        else {
+            break;
         }
+    }
+    std::vector<VirtualVertex> vvs;
+    auto t_he = t_he_sector_start;
+    do {
+        // Incident edge midpoints
+        vvs.push_back(t_he.next().edge());
+
+        // Incident vertices
+        if (!is_blocked(t_he.edge())) {
+            vvs.push_back(t_he.vertex_to());
+        }
+
+        t_he = t_he.prev().opposite(); // Rotate ccw
+    }
+    while (t_he != t_he_sector_end);
+    return vvs;
+}
+
+template <typename LegalStep, typename LowerBound>
+VirtualPath Embedding::find_shortest_path_bidirectional(
+    const VirtualVertex& _vv_start,
+    const VirtualVertex& _vv_end,
+    const LegalStep& _legal_step,
+    const LowerBound& _distance_lower_bound,
+    ShortestPathWorkspace& _ws) const
+{
+    using Candidate = ShortestPathWorkspace::Candidate;
+
+    // Bidirectional A* with the average potential p(v) = (h_end(v) - h_start(v)) / 2 [Goldberg2005].
+    // The forward search uses p, the backward search -p. Both then work on the same (nonnegative) reduced edge lengths,
+    // so the search can stop as soon as the smallest keys of both heaps add up to the length of the best path found so far.
+    ShortestPathWorkspace& ws_fwd = _ws;
+    ShortestPathWorkspace& ws_bwd = _ws.reverse();
+    ws_bwd.reset(target_mesh());
+
+    const tg::pos3 p_start = element_pos(_vv_start);
+    const tg::pos3 p_end = element_pos(_vv_end);
+    auto potential = [&](const VirtualVertex& _vv, const tg::pos3& _p) {
+        return 0.5 * (_distance_lower_bound(_vv, _p, _vv_end, p_end) - _distance_lower_bound(_vv, _p, _vv_start, p_start));
     };
 
+    for (const bool forward : { true, false }) {
+        ShortestPathWorkspace& ws = forward ? ws_fwd : ws_bwd;
+        Candidate c;
+        c.vv = forward ? _vv_start : _vv_end;
+        c.p = forward ? p_start : p_end;
+        c.dist.edges_crossed = 0;
+        c.dist.distance_from_source = 0.0;
+        c.dist.remaining_distance_heuristic = forward ? potential(c.vv, c.p) : -potential(c.vv, c.p);
+        ws.distance(c.vv) = c.dist;
+        ws.push_heap(c);
+    }
+
+    double best_length = std::numeric_limits<double>::infinity();
+    VirtualVertex vv_meet;
+
+    auto key = [](const Candidate& _c) {
+        return _c.dist.distance_from_source + _c.dist.remaining_distance_heuristic;
+    };
+
+    while (!ws_fwd.heap.empty() && !ws_bwd.heap.empty()) {
+        if (key(ws_fwd.heap.front()) + key(ws_bwd.heap.front()) >= best_length) {
+            break;
+        }
+
+        // Expand the smaller frontier
+        const bool forward = ws_fwd.heap.size() <= ws_bwd.heap.size();
+        ShortestPathWorkspace& ws = forward ? ws_fwd : ws_bwd;
+        ShortestPathWorkspace& ws_other = forward ? ws_bwd : ws_fwd;
+
+        const auto u = ws.pop_heap();
+        if (u.dist.distance_from_source > ws.distance(u.vv).distance_from_source) {
+            continue; // Outdated
+        }
+        if (u.vv == (forward ? _vv_end : _vv_start)) {
+            continue; // Paths end here
+        }
+
+        for_each_virtual_neighbor(target_mesh(), u.vv, [&](const VirtualVertex& _vv) {
+            // The backward search traverses the steps of the path in reverse.
+            const bool legal = forward ? _legal_step(u.vv, _vv) : (_legal_step(_vv, u.vv) && (_vv == _vv_start || !is_blocked(_vv)));
+            if (!legal) {
+                return;
+            }
+
+            const tg::pos3 p = element_pos(_vv);
+            const double distance_from_source = u.dist.distance_from_source + tg::distance(u.p, p);
+            auto& dist = ws.distance(_vv);
+            if (distance_from_source < dist.distance_from_source) {
+                dist.distance_from_source = distance_from_source;
+                dist.remaining_distance_heuristic = forward ? potential(_vv, p) : -potential(_vv, p);
+                dist.edges_crossed = u.dist.edges_crossed + (is_real_edge(_vv) ? 1 : 0);
+                ws.prev(_vv) = u.vv;
+
+                Candidate c;
+                c.vv = _vv;
+                c.p = p;
+                c.dist = dist;
+                ws.push_heap(c);
+
+                // Connect to the other search
+                const double length = distance_from_source + ws_other.distance(_vv).distance_from_source;
+                if (length < best_length) {
+                    best_length = length;
+                    vv_meet = _vv;
+                }
+            }
+        });
+    }
+
+    if (std::isinf(best_length)) {
+        return {};
+    }
+
+    VirtualPath path;
+    for (VirtualVertex vv = vv_meet; vv != _vv_start; vv = ws_fwd.prev(vv)) {
+        path.push_back(vv);
+    }
+    path.push_back(_vv_start);
+    std::reverse(path.begin(), path.end());
+    for (VirtualVertex vv = vv_meet; vv != _vv_end; ) {
+        vv = ws_bwd.prev(vv);
+        path.push_back(vv);
+    }
+    return path;
+}
+
+VirtualPath Embedding::find_shortest_path(const pm::halfedge_handle& _t_h_sector_start, const pm::halfedge_handle& _t_h_sector_end, ShortestPathMetric _metric, ShortestPathWorkspace* _workspace) const
+{
+    using Distance = ShortestPathWorkspace::Distance;
+    using Candidate = ShortestPathWorkspace::Candidate;
+
     LE_ASSERT(_t_h_sector_start.mesh == &target_mesh());
     LE_ASSERT(_t_h_sector_end.mesh == &target_mesh());
 
-    VirtualVertexAttribute<VirtualVertex> prev(target_mesh());
-    VirtualVertexAttribute<Distance> distance(target_mesh());
+    ShortestPathWorkspace& ws = _workspace ? *_workspace : ShortestPathWorkspace::thread_local_instance();
+    ws.reset(target_mesh());
 
     const pm::vertex_handle t_v_start = _t_h_sector_start.vertex_from();
     const pm::vertex_handle t_v_end   = _t_h_sector_end.vertex_from();
@@ -304,59 +515,21 @@ VirtualPath Embedding::find_shortest_path(const pm::halfedge_handle& _t_h_sector
     const VirtualVertex vv_start(t_v_start);
     const VirtualVertex vv_end(t_v_end);
 
-    auto get_virtual_vertices_in_sector = [&](const pm::halfedge_handle& t_he_sector) {
-        auto t_he_sector_start = t_he_sector;
-        auto t_he_sector_end = t_he_sector;
-        t_he_sector_end = t_he_sector_end.prev().opposite(); // Rotate ccw
-        while (true) {
-            if (t_he_sector_start == t_he_sector_end) {
-                break;
-            }
-            if (!is_blocked(t_he_sector_start.edge())) {
-                t_he_sector_start = t_he_sector_start.opposite().next(); // Rotate cw
-            }
-            else if (!is_blocked(t_he_sector_end.edge())) {
-                t_he_sector_end = t_he_sector_end.prev().opposite(); // Rotate ccw
-            }
-            else {
-                break;
-            }
-        }
-        std::vector<VirtualVertex> vvs;
-        auto t_he = t_he_sector_start;
-        do {
-            // Incident edge midpoints
-            vvs.push_back(t_he.next().edge());
-
-            // Incident vertices
-            if (!is_blocked(t_he.edge())) {
-                vvs.push_back(t_he.vertex_to());
-            }
+    const bool use_landmarks = (_metric == ShortestPathMetric::Geodesic) && sp_settings.use_landmark_heuristic;
+    const std::shared_ptr<const ShortestPathLandmarks> lm = use_landmarks ? get_landmarks() : nullptr;
 
-            t_he = t_he.prev().opposite(); // Rotate ccw
+    // Lower bound of the (geodesic) distance between two virtual vertices
+    auto distance_lower_bound = [&](const VirtualVertex& _vv_a, const tg::pos3& _p_a, const VirtualVertex& _vv_b, const tg::pos3& _p_b) {
+        double result = tg::distance(_p_a, _p_b);
+        if (lm) {
+            result = std::max(result, lm->lower_bound(_vv_a, _vv_b));
         }
-        while (t_he != t_he_sector_end);
-        return vvs;
+        return result;
     };
 
     std::vector<VirtualVertex> legal_first_vvs = get_virtual_vertices_in_sector(_t_h_sector_start);
     std::vector<VirtualVertex> legal_last_vvs = get_virtual_vertices_in_sector(_t_h_sector_end);
 
-    distance[t_v_start].edges_crossed = 0;
-    distance[t_v_start].distance_from_source = 0.0;
-
-    std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> q;
-
-    {
-        Candidate c;
-        c.vv = VirtualVertex(t_v_start);
-        c.p = t_pos[t_v_start];
-        c.dist.edges_crossed = 0;
-        c.dist.distance_from_source = 0.0;
-        c.dist.remaining_distance_heuristic = std::numeric_limits<double>::max();
-        q.push(c);
-    }
-
     auto legal_step = [&](const VirtualVertex& from, const VirtualVertex& to) {
         if (from == vv_start) {
             if (std::find(legal_first_vvs.cbegin(), legal_first_vvs.cend(), to) == legal_first_vvs.cend()) {
@@ -378,15 +551,32 @@ VirtualPath Embedding::find_shortest_path(const pm::halfedge_handle& _t_h_sector
         return true;
     };
 
+    if (_metric == ShortestPathMetric::Geodesic && sp_settings.use_bidirectional_search) {
+        return find_shortest_path_bidirectional(vv_start, vv_end, legal_step, distance_lower_bound, ws);
+    }
+
+    ws.distance(t_v_start).edges_crossed = 0;
+    ws.distance(t_v_start).distance_from_source = 0.0;
+
+    {
+        Candidate c;
+        c.vv = VirtualVertex(t_v_start);
+        c.p = t_pos[t_v_start];
+        c.dist.edges_crossed = 0;
+        c.dist.distance_from_source = 0.0;
+        c.dist.remaining_distance_heuristic = std::numeric_limits<double>::max();
+        ws.push_heap(c);
+    }
+
     auto visit_vv = [&](const Candidate& c, const VirtualVertex& vv) {
         if (legal_step(c.vv, vv)) {
-            const Distance& current_dist = distance[vv];
+            const Distance& current_dist = ws.distance(vv);
             const auto& p = element_pos(vv);
             Distance new_dist = c.dist;
 
             if (_metric == ShortestPathMetric::Geodesic) {
                 new_dist.distance_from_source += tg::distance(c.p, p);
-                new_dist.remaining_distance_heuristic = tg::distance(p, t_pos[t_v_end]);
+                new_dist.remaining_distance_heuristic = distance_lower_bound(vv, p, vv_end, t_pos[t_v_end]);
             }
             else if (_metric == ShortestPathMetric::VertexRepulsive) {
                 const auto& l_v_start = matching_layout_vertex(t_v_start);
@@ -412,72 +602,28 @@ VirtualPath Embedding::find_shortest_path(const pm::halfedge_handle& _t_h_sector
                 new_c.p = p;
                 new_c.dist = new_dist;
 
-                distance[vv] = new_c.dist;
-                prev[vv] = c.vv;
+                ws.distance(vv) = new_c.dist;
+                ws.prev(vv) = c.vv;
 
-                q.push(new_c);
+                ws.push_heap(new_c);
             }
         }
     };
 
-    while (!q.empty()) {
-        const auto u = q.top();
-        q.pop();
-
-        const auto& vv = u.vv;
-
-        // Expand vertex neighborhood
-        if (is_real_vertex(vv)) {
-            const auto& t_v = real_vertex(u.vv, target_mesh());
-
-            if (t_v == t_v_end) {
-                break;
-            }
+    while (!ws.heap.empty()) {
+        const auto u = ws.pop_heap();
 
-            // Add incident vertices (if they're not blocked)
-            for (const auto t_v_adj : t_v.adjacent_vertices()) {
-                visit_vv(u, VirtualVertex(t_v_adj));
-            }
-
-            // Add incident edge midpoints (if they're not blocked)
-            for (const auto t_he_out : t_v.outgoing_halfedges()) {
-                if (t_he_out.is_boundary()) {
-                    continue;
-                }
-                const auto eh_opp_edge = t_he_out.next().edge();
-                visit_vv(u, VirtualVertex(eh_opp_edge));
-            }
+        if (u.vv == vv_end) {
+            break;
         }
-        // Expand edge midpoint neighborhood
-        else if (is_real_edge(vv)) {
-            const auto& t_e = real_edge(vv, target_mesh());
 
-            const auto& t_he = t_e.halfedgeA();
-            const auto& t_he_opp = t_e.halfedgeB();
-
-            // Visit opposite vertices
-            const auto& t_v_u = opposite_vertex(t_he);
-            const auto& t_v_u_opp = opposite_vertex(t_he_opp);
-            visit_vv(u, VirtualVertex(t_v_u));
-            visit_vv(u, VirtualVertex(t_v_u_opp));
-
-            // Visit incident edges
-            if (!t_he.is_boundary()) {
-                const auto& eh_u_r = t_he.next().edge();
-                const auto& eh_u_l = t_he.prev().edge();
-                visit_vv(u, eh_u_r);
-                visit_vv(u, eh_u_l);
-            }
-            if (!t_he_opp.is_boundary()) {
-                const auto& eh_u_opp_r = t_he_opp.prev().edge();
-                const auto& eh_u_opp_l = t_he_opp.next().edge();
-                visit_vv(u, eh_u_opp_r);
-                visit_vv(u, eh_u_opp_l);
-            }
-        }
+        // Expand vertex or edge midpoint neighborhood (if they're not blocked)
+        for_each_virtual_neighbor(target_mesh(), u.vv, [&](const VirtualVertex& _vv) {
+            visit_vv(u, _vv);
+        });
     }
 
-    if (std::isinf(distance[t_v_end].distance_from_source)) {
+    if (std::isinf(ws.distance(t_v_end).distance_from_source)) {
         return {};
     }
     else {
@@ -486,7 +632,7 @@ VirtualPath Embedding::find_shortest_path(const pm::halfedge_handle& _t_h_sector
         VirtualVertex vv_start(t_v_start);
         while (vv_current != vv_start) {
             path.push_back(vv_current);
-            vv_current = prev[vv_current];
+            vv_current = ws.prev(vv_current);
         }
         path.push_back(vv_start);
         std::reverse(path.begin(), path.end());
@@ -494,6 +640,177 @@ VirtualPath Embedding::find_shortest_path(const pm::halfedge_handle& _t_h_sector
     }
 }
 
+std::vector<VirtualPath> Embedding::find_shortest_paths(const std::vector<pm::halfedge_handle>& _l_hes, ShortestPathMetric _metric, ShortestPathWorkspace* _workspace) const
+{
+    const int n = _l_hes.size();
+    std::vector<VirtualPath> result(n);
+    if (n == 0) {
+        return result;
+    }
+
+    const auto l_v = _l_hes.front().vertex_from();
+    std::vector<pm::halfedge_handle> t_h_sector_starts(n);
+    std::vector<pm::halfedge_handle> t_h_sector_ends(n);
+    for (int i = 0; i < n; ++i) {
+        LE_ASSERT(_l_hes[i].mesh == &layout_mesh());
+        LE_ASSERT(_l_hes[i].vertex_from() == l_v);
+        LE_ASSERT(!is_embedded(_l_hes[i]));
+        t_h_sector_starts[i] = get_embeddable_sector(_l_hes[i]);
+        t_h_sector_ends[i] = get_embeddable_sector(_l_hes[i].opposite());
+    }
+
+    // The VertexRepulsive metric depends on the end vertex, so each path needs its own search.
+    if (_metric != ShortestPathMetric::Geodesic) {
+        for (int i = 0; i < n; ++i) {
+            result[i] = find_shortest_path(t_h_sector_starts[i], t_h_sector_ends[i], _metric, _workspace);
+        }
+        return result;
+    }
+
+    // One search per start sector
+    std::vector<bool> done(n, false);
+    for (int i = 0; i < n; ++i) {
+        if (done[i]) {
+            continue;
+        }
+        std::vector<int> group;
+        for (int j = i; j < n; ++j) {
+            if (!done[j] && t_h_sector_starts[j] == t_h_sector_starts[i]) {
+                group.push_back(j);
+                done[j] = true;
+            }
+        }
+
+        if (group.size() == 1) {
+            result[i] = find_shortest_path(t_h_sector_starts[i], t_h_sector_ends[i], _metric, _workspace);
+            continue;
+        }
+
+        std::vector<pm::halfedge_handle> group_sector_ends;
+        for (const int j : group) {
+            group_sector_ends.push_back(t_h_sector_ends[j]);
+        }
+        auto paths = find_shortest_paths_from_sector(t_h_sector_starts[i], group_sector_ends, _workspace);
+        for (int k = 0; k < (int)group.size(); ++k) {
+            result[group[k]] = std::move(paths[k]);
+        }
+    }
+
+    return result;
+}
+
+std::vector<VirtualPath> Embedding::find_shortest_paths_from_sector(const pm::halfedge_handle& _t_h_sector_start, const std::vector<pm::halfedge_handle>& _t_h_sector_ends, ShortestPathWorkspace* _workspace) const
+{
+    using Candidate = ShortestPathWorkspace::Candidate;
+
+    ShortestPathWorkspace& ws = _workspace ? *_workspace : ShortestPathWorkspace::thread_local_instance();
+    ws.reset(target_mesh());
+
+    const pm::vertex_handle t_v_start = _t_h_sector_start.vertex_from();
+    const VirtualVertex vv_start(t_v_start);
+    const std::vector<VirtualVertex> legal_first_vvs = get_virtual_vertices_in_sector(_t_h_sector_start);
+
+    // Several layout edges can end at the same target vertex (in different sectors).
+    // Targets are pinned, so they are never expanded and each one keeps its own predecessor.
+    struct Target
+    {
+        VirtualVertex vv;
+        std::vector<VirtualVertex> legal_last_vvs;
+        double distance = std::numeric_limits<double>::infinity();
+        VirtualVertex prev;
+        bool settled = false;
+    };
+    std::vector<Target> targets(_t_h_sector_ends.size());
+    for (std::size_t i = 0; i < targets.size(); ++i) {
+        targets[i].vv = VirtualVertex(_t_h_sector_ends[i].vertex_from());
+        targets[i].legal_last_vvs = get_virtual_vertices_in_sector(_t_h_sector_ends[i]);
+    }
+    int num_unsettled = targets.size();
+
+    // Dijkstra: Without a single end vertex there is no (consistent) A* heuristic.
+    {
+        Candidate c;
+        c.vv = vv_start;
+        c.p = t_pos[t_v_start];
+        c.dist.edges_crossed = 0;
+        c.dist.distance_from_source = 0.0;
+        ws.distance(vv_start) = c.dist;
+        ws.push_heap(c);
+    }
+
+    while (!ws.heap.empty() && num_unsettled > 0) {
+        const auto u = ws.pop_heap();
+        if (u.dist.distance_from_source > ws.distance(u.vv).distance_from_source) {
+            continue; // Outdated
+        }
+
+        // No shorter paths to targets at most as far as u can be found
+        for (auto& target : targets) {
+            if (!target.settled && target.distance <= u.dist.distance_from_source) {
+                target.settled = true;
+                --num_unsettled;
+            }
+        }
+        if (num_unsettled == 0) {
+            break;
+        }
+
+        for_each_virtual_neighbor(target_mesh(), u.vv, [&](const VirtualVertex& _vv) {
+            if (u.vv == vv_start) {
+                if (std::find(legal_first_vvs.cbegin(), legal_first_vvs.cend(), _vv) == legal_first_vvs.cend()) {
+                    return;
+                }
+            }
+
+            const tg::pos3 p = element_pos(_vv);
+            const double distance_from_source = u.dist.distance_from_source + tg::distance(u.p, p);
+
+            if (is_real_vertex(_vv) && matching_layout_vertex(real_vertex(_vv, target_mesh())).is_valid()) {
+                for (auto& target : targets) {
+                    if (target.vv == _vv && distance_from_source < target.distance
+                            && std::find(target.legal_last_vvs.cbegin(), target.legal_last_vvs.cend(), u.vv) != target.legal_last_vvs.cend()) {
+                        target.distance = distance_from_source;
+                        target.prev = u.vv;
+                    }
+                }
+                return;
+            }
+
+            if (is_blocked(_vv)) {
+                return;
+            }
+
+            auto& dist = ws.distance(_vv);
+            if (distance_from_source < dist.distance_from_source) {
+                dist.distance_from_source = distance_from_source;
+                dist.edges_crossed = u.dist.edges_crossed + (is_real_edge(_vv) ? 1 : 0);
+                ws.prev(_vv) = u.vv;
+
+                Candidate c;
+                c.vv = _vv;
+                c.p = p;
+                c.dist = dist;
+                ws.push_heap(c);
+            }
+        });
+    }
+
+    std::vector<VirtualPath> result(targets.size());
+    for (std::size_t i = 0; i < targets.size(); ++i) {
+        if (std::isinf(targets[i].distance)) {
+            continue;
+        }
+        VirtualPath& path = result[i];
+        path.push_back(targets[i].vv);
+        for (VirtualVertex vv = targets[i].prev; vv != vv_start; vv = ws.prev(vv)) {
+            path.push_back(vv);
+        }
+        path.push_back(vv_start);
+        std::reverse(path.begin(), path.end());
+    }
+    return result;
+}
+
 VirtualPath Embedding::find_shortest_path(const pm::halfedge_handle& _l_he, ShortestPathMetric _metric) const
 {
     LE_ASSERT(_l_he.mesh == &layout_mesh());
@@ -532,8 +849,10 @@ void Embedding::embed_path(const pm::halfedge_handle& _l_he, const VirtualPath&
 
     // Turn the VertexEdgePath into a pure vertex path by splitting edges
     std::vector<pm::vertex_handle> vertex_path;
+    bool refined = false;
     for (const auto& vv : _path) {
         if (is_real_edge(vv)) {
+            refined = true;
             const auto& t_e = real_edge(vv, target_mesh());
             const auto& t_vA = t_e.vertexA();
             const auto& t_vB = t_e.vertexB();
@@ -542,12 +861,12 @@ void Embedding::embed_path(const pm::halfedge_handle& _l_he, const VirtualPath&
             const auto& p1 = t_pos[t_vB];
             const auto p = tg::mix(p0, p1, 0.5);
 
+            record_split(t_e);
             const auto t_v_new = target_mesh().edges().split_and_triangulate(t_e);
             t_pos[t_v_new] = p;
 
             if (vertex_repulsive_energy.has_value()) {
-                Eigen::VectorXd vre = 0.5 * (*vertex_repulsive_energy)[t_vA] + 0.5 * (*vertex_repulsive_energy)[t_vB];
-                (*vertex_repulsive_energy)[t_v_new] = vre;
+                vertex_repulsive_energy->add_split_vertex(t_v_new.idx.value, t_vA.idx.value, t_vB.idx.value);
             }
 
             vertex_path.push_back(t_v_new);
@@ -556,6 +875,9 @@ void Embedding::embed_path(const pm::halfedge_handle& _l_he, const VirtualPath&
             vertex_path.push_back(real_vertex(vv, target_mesh()));
         }
     }
+    if (refined) {
+        reset_landmarks();
+    }
 
     // Mark the halfedges along the newly subdivided vertex path
     for (int i = 0; i < vertex_path.size() - 1; ++i) {
@@ -564,18 +886,25 @@ void Embedding::embed_path(const pm::halfedge_handle& _l_he, const VirtualPath&
         LE_ASSERT(t_he.is_valid());
         LE_ASSERT(matching_layout_halfedge(t_he).is_invalid());
         LE_ASSERT(matching_layout_halfedge(t_he.opposite()).is_invalid());
+        record_matching_layout_halfedge(t_he);
+        record_matching_layout_halfedge(t_he.opposite());
         t_matching_halfedge[t_he] = _l_he;
         t_matching_halfedge[t_he.opposite()] = _l_he.opposite();
     }
+    set_embedded_path(_l_he, vertex_path);
 }
 
 void Embedding::embed_path(const pm::halfedge_handle& _l_he, const Snake& _snake)
 {
+    LE_ASSERT(!recording); // Snake embedding does not support the undo log
     LE_ASSERT(!get_embedded_target_halfedge(_l_he).is_valid());
     LE_ASSERT_GEQ(_snake.vertices.size(), 2);
 
     // Turn the Snake into a pure vertex path by splitting edges
+    // The new vertices are not at edge midpoints, so the vertex repulsive energy can't be interpolated.
     const auto vertex_path = embed_snake(_snake, t_m, t_pos);
+    reset_vertex_repulsive_energy();
+    reset_landmarks();
     LE_ASSERT(matching_layout_vertex(vertex_path.front()).is_valid());
     LE_ASSERT(matching_layout_vertex(vertex_path.back()).is_valid());
     LE_ASSERT(matching_layout_vertex(vertex_path.front()) == _l_he.vertex_from());
@@ -591,6 +920,7 @@ void Embedding::embed_path(const pm::halfedge_handle& _l_he, const Snake& _snake
         t_matching_halfedge[t_he] = _l_he;
         t_matching_halfedge[t_he.opposite()] = _l_he.opposite();
     }
+    set_embedded_path(_l_he, vertex_path);
 }
 
 void Embedding::unembed_path(const pm::halfedge_handle& _l_he)
@@ -602,9 +932,12 @@ void Embedding::unembed_path(const pm::halfedge_handle& _l_he)
         const auto& t_he = pm::halfedge_from_to(t_v_i, t_v_j);
         LE_ASSERT(t_matching_halfedge[t_he] == _l_he);
         LE_ASSERT(t_matching_halfedge[t_he.opposite()] == _l_he.opposite());
+        record_matching_layout_halfedge(t_he);
+        record_matching_layout_halfedge(t_he.opposite());
         t_matching_halfedge[t_he] = pm::halfedge_handle::invalid;
         t_matching_halfedge[t_he.opposite()] = pm::halfedge_handle::invalid;
     }
+    clear_embedded_path(_l_he.edge().idx);
     LE_ASSERT(!is_embedded(_l_he));
 }
 
@@ -613,31 +946,299 @@ void Embedding::unembed_path(const pm::edge_handle& _l_e)
     unembed_path(_l_e.halfedgeA());
 }
 
-std::vector<pm::vertex_handle> Embedding::get_embedded_path(const pm::halfedge_handle& _l_he) const
+Embedding::Checkpoint Embedding::checkpoint()
 {
-    LE_ASSERT(is_embedded(_l_he));
-    std::vector<pm::vertex_handle> result;
-    const auto t_v_start = get_embedded_target_halfedge(_l_he).vertex_from();
-    const auto t_v_end = l_matching_vertex[_l_he.vertex_to()];
-    auto t_v = t_v_start;
-    int safeguard = 0;
-    while (t_v != t_v_end) {
-        LE_ASSERT(t_v.is_valid());
-        result.push_back(t_v);
+    // New elements are appended to a compact mesh, so rollback can remove them by truncating the arrays.
+    LE_ASSERT(t_m.is_compact());
+
+    Checkpoint cp;
+    cp.log_size = undo_log.size();
+    cp.num_vertices = t_m.all_vertices().size();
+    cp.num_edges = t_m.all_edges().size();
+    cp.num_faces = t_m.all_faces().size();
+    cp.num_embedded_paths = num_embedded_paths;
+    cp.total_embedded_path_length = total_length;
+    cp.had_vertex_repulsive_energy = vertex_repulsive_energy.has_value();
+    {
+        std::lock_guard<std::mutex> lock(landmarks_mutex);
+        cp.landmarks = landmarks;
+    }
+    cp.outermost = !recording;
+    recording = true;
+    return cp;
+}
 
-        bool next_vertex_found = false;
-        for (const auto t_he : t_v.outgoing_halfedges()) {
-            if (t_matching_halfedge[t_he] == _l_he) {
-                t_v = t_he.vertex_to();
-                next_vertex_found = true;
+void Embedding::rollback(const Checkpoint& _cp)
+{
+    LE_ASSERT(recording);
+    LE_ASSERT_LEQ(_cp.log_size, undo_log.size());
+
+    auto ll = pm::low_level_api(t_m);
+
+    // Restore pre-images in reverse order, so the oldest pre-image of each element is written last.
+    for (size_t i = undo_log.size(); i > _cp.log_size; --i) {
+        const auto& r = undo_log[i - 1];
+        switch (r.type) {
+        case UndoRecord::Type::Halfedge: {
+            const pm::halfedge_index t_h(r.idx);
+            ll.to_vertex_of(t_h) = pm::vertex_index(r.value[0]);
+            ll.face_of(t_h) = pm::face_index(r.value[1]);
+            ll.next_halfedge_of(t_h) = pm::halfedge_index(r.value[2]);
+            ll.prev_halfedge_of(t_h) = pm::halfedge_index(r.value[3]);
+            break;
+        }
+        case UndoRecord::Type::Vertex:
+            ll.outgoing_halfedge_of(pm::vertex_index(r.idx)) = pm::halfedge_index(r.value[0]);
+            break;
+        case UndoRecord::Type::Face:
+            ll.halfedge_of(pm::face_index(r.idx)) = pm::halfedge_index(r.value[0]);
+            break;
+        case UndoRecord::Type::MatchingLayoutHalfedge:
+            t_matching_halfedge[pm::halfedge_index(r.idx)] = layout_mesh()[pm::halfedge_index(r.value[0])];
+            break;
+        case UndoRecord::Type::EmbeddedPath:
+            embedded_paths[r.idx] = std::move(undo_embedded_paths[r.value[0]]);
+            undo_embedded_paths.resize(r.value[0]);
+            break;
+        }
+    }
+    undo_log.resize(_cp.log_size);
+    num_embedded_paths = _cp.num_embedded_paths;
+    total_length = _cp.total_embedded_path_length;
+
+    // Remove the elements created since the checkpoint.
+    // They are located at the end of the mesh and no restored element refers to them anymore,
+    // so the primitive and attribute arrays are truncated in O(#new elements) instead of compactifying the mesh.
+    ll.truncate_faces(_cp.num_faces);
+    ll.truncate_edges(_cp.num_edges); // Along with their halfedges
+    ll.truncate_vertices(_cp.num_vertices);
+
+    LE_ASSERT_EQ(t_m.all_vertices().size(), _cp.num_vertices);
+    LE_ASSERT_EQ(t_m.all_edges().size(), _cp.num_edges);
+    LE_ASSERT_EQ(t_m.all_faces().size(), _cp.num_faces);
+
+    // A vertex repulsive energy computed on the refined mesh would not be valid anymore.
+    if (!_cp.had_vertex_repulsive_energy) {
+        vertex_repulsive_energy.reset();
+        vertex_repulsive_energy_ready = false;
+    }
+    else {
+        vertex_repulsive_energy->truncate(_cp.num_vertices);
+    }
+
+    // Landmarks computed on the refined mesh would not be valid anymore, the ones of the checkpoint are again.
+    {
+        std::lock_guard<std::mutex> lock(landmarks_mutex);
+        landmarks = _cp.landmarks;
+    }
+}
+
+void Embedding::commit(const Checkpoint& _cp)
+{
+    LE_ASSERT(recording);
+    if (_cp.outermost) {
+        undo_log.clear();
+        undo_embedded_paths.clear();
+        recording = false;
+    }
+}
+
+bool Embedding::is_recording() const
+{
+    return recording;
+}
+
+void Embedding::record_halfedge(const pm::halfedge_handle& _t_h)
+{
+    if (!recording) {
+        return;
+    }
+    const auto ll = pm::low_level_api(t_m);
+    UndoRecord r;
+    r.type = UndoRecord::Type::Halfedge;
+    r.idx = _t_h.idx.value;
+    r.value[0] = ll.to_vertex_of(_t_h).value;
+    r.value[1] = ll.face_of(_t_h).value;
+    r.value[2] = ll.next_halfedge_of(_t_h).value;
+    r.value[3] = ll.prev_halfedge_of(_t_h).value;
+    undo_log.push_back(r);
+}
+
+void Embedding::record_vertex(const pm::vertex_handle& _t_v)
+{
+    if (!recording) {
+        return;
+    }
+    const auto ll = pm::low_level_api(t_m);
+    UndoRecord r;
+    r.type = UndoRecord::Type::Vertex;
+    r.idx = _t_v.idx.value;
+    r.value[0] = ll.outgoing_halfedge_of(_t_v).value;
+    undo_log.push_back(r);
+}
+
+void Embedding::record_face(const pm::face_handle& _t_f)
+{
+    if (!recording) {
+        return;
+    }
+    const auto ll = pm::low_level_api(t_m);
+    UndoRecord r;
+    r.type = UndoRecord::Type::Face;
+    r.idx = _t_f.idx.value;
+    r.value[0] = ll.halfedge_of(_t_f).value;
+    undo_log.push_back(r);
+}
+
+void Embedding::record_matching_layout_halfedge(const pm::halfedge_handle& _t_h)
+{
+    if (!recording) {
+        return;
+    }
+    UndoRecord r;
+    r.type = UndoRecord::Type::MatchingLayoutHalfedge;
+    r.idx = _t_h.idx.value;
+    r.value[0] = t_matching_halfedge[_t_h].idx.value;
+    undo_log.push_back(r);
+}
+
+void Embedding::record_split(const pm::edge_handle& _t_e)
+{
+    if (!recording) {
+        return;
+    }
+    // Superset of the elements modified by split_and_triangulate:
+    // Both halfedges, the incident faces, and their halfedges and vertices.
+    // On the boundary, the neighbors of the boundary halfedge are relinked to the new one.
+    for (const auto t_h : {_t_e.halfedgeA(), _t_e.halfedgeB()}) {
+        record_halfedge(t_h);
+        record_vertex(t_h.vertex_to());
+        if (t_h.is_boundary()) {
+            record_halfedge(t_h.next());
+            record_halfedge(t_h.prev());
+        }
+        else {
+            const auto t_f = t_h.face();
+            record_face(t_f);
+            for (const auto t_h_f : t_f.halfedges()) {
+                record_halfedge(t_h_f);
+                record_vertex(t_h_f.vertex_to());
+            }
+        }
+    }
+}
+
+void Embedding::record_embedded_path(const pm::edge_index& _l_e)
+{
+    if (!recording) {
+        return;
+    }
+    UndoRecord r;
+    r.type = UndoRecord::Type::EmbeddedPath;
+    r.idx = _l_e.value;
+    r.value[0] = undo_embedded_paths.size();
+    undo_embedded_paths.push_back(embedded_paths[_l_e.value]);
+    undo_log.push_back(r);
+}
+
+void Embedding::set_embedded_path(const pm::halfedge_handle& _l_he, const std::vector<pm::vertex_handle>& _t_vertex_path)
+{
+    LE_ASSERT_GEQ(_t_vertex_path.size(), 2);
+    const auto l_e = _l_he.edge();
+    record_embedded_path(l_e.idx);
+
+    auto& ep = embedded_paths[l_e.idx.value];
+    LE_ASSERT(ep.vertices.empty());
+    ep.vertices.reserve(_t_vertex_path.size());
+    for (const auto& t_v : _t_vertex_path) {
+        ep.vertices.push_back(t_v.idx);
+    }
+    if (_l_he != l_e.halfedgeA()) {
+        std::reverse(ep.vertices.begin(), ep.vertices.end());
+    }
+
+    const auto n = ep.vertices.size();
+    ep.t_h_A = pm::halfedge_from_to(target_mesh()[ep.vertices[0]], target_mesh()[ep.vertices[1]]).idx;
+    ep.t_h_B = pm::halfedge_from_to(target_mesh()[ep.vertices[n - 1]], target_mesh()[ep.vertices[n - 2]]).idx;
+
+    ep.length = 0.0;
+    for (size_t i = 0; i + 1 < n; ++i) {
+        ep.length += tg::distance(t_pos[ep.vertices[i]], t_pos[ep.vertices[i + 1]]);
+    }
+
+    ++num_embedded_paths;
+    total_length += ep.length;
+}
+
+void Embedding::clear_embedded_path(const pm::edge_index& _l_e)
+{
+    record_embedded_path(_l_e);
+
+    auto& ep = embedded_paths[_l_e.value];
+    LE_ASSERT(!ep.vertices.empty());
+    --num_embedded_paths;
+    total_length = (num_embedded_paths > 0) ? total_length - ep.length : 0.0; // Avoid accumulating round-off
+    ep = EmbeddedPath();
+}
+
+void Embedding::update_embedded_paths()
+{
+    LE_ASSERT(!recording);
+
+    // The target mesh might have been modified without add_split_vertex()
+    reset_vertex_repulsive_energy();
+    reset_landmarks();
+
+    embedded_paths.clear();
+    embedded_paths.resize(layout_mesh().all_edges().size());
+    num_embedded_paths = 0;
+    total_length = 0.0;
+
+    for (const auto l_e : layout_mesh().edges()) {
+        const auto l_he = l_e.halfedgeA();
+        const auto t_v_start = l_matching_vertex[l_he.vertex_from()];
+        const auto t_v_end = l_matching_vertex[l_he.vertex_to()];
+        LE_ASSERT(t_v_start.is_valid());
+
+        // Trace the labeled halfedges
+        std::vector<pm::vertex_handle> path;
+        auto t_v = t_v_start;
+        while (true) {
+            auto t_h_next = pm::halfedge_handle::invalid;
+            for (const auto t_he : t_v.outgoing_halfedges()) {
+                if (t_matching_halfedge[t_he] == l_he) {
+                    t_h_next = t_he;
+                    break;
+                }
+            }
+            if (t_h_next.is_invalid()) {
                 break;
             }
+            path.push_back(t_v);
+            t_v = t_h_next.vertex_to();
+            LE_ASSERT_L(path.size(), t_m.all_vertices().size());
+        }
+
+        if (!path.empty()) {
+            LE_ASSERT(t_v == t_v_end);
+            path.push_back(t_v_end);
+            set_embedded_path(l_he, path);
         }
-        LE_ASSERT(next_vertex_found);
-        LE_ASSERT_L(safeguard, 1e7);
-        ++safeguard;
     }
-    result.push_back(t_v_end);
+}
+
+std::vector<pm::vertex_handle> Embedding::get_embedded_path(const pm::halfedge_handle& _l_he) const
+{
+    LE_ASSERT(is_embedded(_l_he));
+    const auto& vertices = embedded_paths[_l_he.edge().idx.value].vertices;
+    std::vector<pm::vertex_handle> result;
+    result.reserve(vertices.size());
+    for (const auto& t_v : vertices) {
+        result.push_back(target_mesh()[t_v]);
+    }
+    if (_l_he != _l_he.edge().halfedgeA()) {
+        std::reverse(result.begin(), result.end());
+    }
     return result;
 }
 
@@ -677,17 +1278,7 @@ std::vector<pm::face_handle> Embedding::get_patch(const pm::face_handle& _l_f) c
 double Embedding::embedded_path_length(const pm::halfedge_handle& _l_he) const
 {
     LE_ASSERT(is_embedded(_l_he));
-    const auto& path = get_embedded_path(_l_he);
-    LE_ASSERT_GEQ(path.size(), 2);
-    double length = 0.0;
-    for (int i = 0; i < path.size() - 1; ++i) {
-        const auto& v_i = path[i];
-        const auto& v_j = path[i + 1];
-        const auto& p_i = t_pos[v_i];
-        const auto& p_j = t_pos[v_j];
-        length += tg::distance(p_i, p_j);
-    }
-    return length;
+    return embedded_paths[_l_he.edge().idx.value].length;
 }
 
 double Embedding::embedded_path_length(const polymesh::edge_handle& _l_e) const
@@ -697,23 +1288,22 @@ double Embedding::embedded_path_length(const polymesh::edge_handle& _l_e) const
 
 double Embedding::total_embedded_path_length() const
 {
-    double total_length = 0.0;
-    for (const auto& l_e : layout_mesh().edges()) {
-        if (is_embedded(l_e)) {
-            total_length += embedded_path_length(l_e);
-        }
-    }
     return total_length;
 }
 
 bool Embedding::is_complete() const
 {
-    for (const auto& l_e : layout_mesh().edges()) {
-        if (!is_embedded(l_e)) {
-            return false;
-        }
-    }
-    return true;
+    return num_embedded_paths == (int)layout_mesh().edges().size();
+}
+
+const EmbeddingInput& Embedding::embedding_input() const
+{
+    return *input;
+}
+
+EmbeddingInput& Embedding::embedding_input()
+{
+    return *input;
 }
 
 const pm::Mesh& Embedding::layout_mesh() const
@@ -775,20 +1365,28 @@ pm::halfedge_handle& Embedding::matching_layout_halfedge(const pm::halfedge_hand
     return t_matching_halfedge[_t_h];
 }
 
+void Embedding::reset_vertex_repulsive_energy()
+{
+    std::lock_guard<std::mutex> lock(vertex_repulsive_energy_mutex);
+    vertex_repulsive_energy.reset();
+    vertex_repulsive_energy_ready = false;
+}
+
 double Embedding::get_vertex_repulsive_energy(const pm::vertex_handle& _t_v, const pm::vertex_handle& _l_v) const
 {
     LE_ASSERT(_t_v.mesh == &target_mesh());
     LE_ASSERT(_l_v.mesh == &layout_mesh());
 
-    if (!vertex_repulsive_energy.has_value()) {
-        Eigen::MatrixXd vre = compute_vertex_repulsive_energy(*this);
-        vertex_repulsive_energy = target_mesh().vertices().make_attribute<Eigen::VectorXd>();
-        for (const auto t_v : target_mesh().vertices()) {
-            (*vertex_repulsive_energy)[t_v] = vre.row(t_v.idx.value);
+    if (!vertex_repulsive_energy_ready) {
+        // Might be called concurrently from multiple threads
+        std::lock_guard<std::mutex> lock(vertex_repulsive_energy_mutex);
+        if (!vertex_repulsive_energy.has_value()) {
+            vertex_repulsive_energy.emplace(*this, sp_settings.max_num_vertex_repulsive_fields, sp_settings.vertex_repulsive_solver);
         }
+        vertex_repulsive_energy_ready = true;
     }
     LE_ASSERT(vertex_repulsive_energy.has_value());
-    return (*vertex_repulsive_energy)[_t_v][_l_v.idx.value];
+    return vertex_repulsive_energy->value(_t_v.idx.value, _l_v.idx.value);
 }
 
 double Embedding::get_vertex_repulsive_energy(const VirtualVertex& _t_vv, const pm::vertex_handle& _l_v) const
@@ -811,6 +1409,8 @@ double Embedding::get_vertex_repulsive_energy(const VirtualVertex& _t_vv, const
 
 bool Embedding::load(std::string filename)
 {
+    LE_ASSERT(!recording);
+
     std::string em_file_name = filename + ".lem";
     // These two names are loaded in from the .lem file
     std::string inp_file_name;
@@ -967,8 +1567,15 @@ bool Embedding::load(std::string filename)
             t_matching_halfedge[target_halfedge] = layout_halfedge;
             t_matching_halfedge[target_halfedge.opposite()] = layout_halfedge.opposite();
         }
+    }
 
-        LE_ASSERT_EQ(get_embedded_path(layout_halfedge).size(), snake_length);
+    update_embedded_paths();
+    for (const auto& embedded_edge : ee_token_vector)
+    {
+        const auto from_vertex_handle = input->l_m[pm::vertex_index(embedded_edge.first.first)];
+        const auto to_vertex_handle = input->l_m[pm::vertex_index(embedded_edge.first.second)];
+        const auto layout_halfedge = pm::halfedge_from_to(from_vertex_handle, to_vertex_handle);
+        LE_ASSERT_EQ(get_embedded_path(layout_halfedge).size(), embedded_edge.second.size());
     }
 
     for (auto l_v : layout_mesh().vertices())
@@ -2,17 +2,23 @@
 
 #include <LayoutEmbedding/EmbeddingInput.hh>
 #include <LayoutEmbedding/LayoutGeneration.hh>
+#include <LayoutEmbedding/VertexRepulsiveEnergy.hh>
 #include <LayoutEmbedding/VirtualVertex.hh>
 #include <LayoutEmbedding/VirtualPath.hh>
 #include <polymesh/formats/obj.hh>
 
 #include <Eigen/Dense>
 
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <optional>
 
 namespace LayoutEmbedding {
 
+class ShortestPathLandmarks;
 struct Snake;
+struct ShortestPathWorkspace;
 
 class Embedding
 {
@@ -22,6 +28,11 @@ public:
     Embedding(const Embedding& _em);
     Embedding& operator=(const Embedding& _em);
 
+    /// Copies _em but refers to _input instead of the original input.
+    /// _input has to be an (index-preserving) copy of the original input.
+    /// Useful to give each thread its own layout mesh, since attributes can't be registered concurrently.
+    Embedding(const Embedding& _em, EmbeddingInput& _input);
+
     /// If the layout halfedge _l_h has an embedding, returns the target halfedge at the start of the corresponding embedded path.
     /// Otherwise, returns an invalid halfedge.
     pm::halfedge_handle get_embedded_target_halfedge(const pm::halfedge_handle& _l_he) const;
@@ -48,10 +59,24 @@ public:
         VertexRepulsive,
     };
 
+    /// Optional speedups of find_shortest_path() for the Geodesic metric.
+    /// The VertexRepulsive metric is not additive along a path, so it always uses a unidirectional search without heuristic.
+    struct ShortestPathSettings
+    {
+        bool use_bidirectional_search = false;
+        bool use_landmark_heuristic = false; // ALT heuristic, see ShortestPathLandmarks. Computed from the matched target vertices on the current target mesh, recomputed after each refinement.
+        int max_num_landmarks = 16;
+        int max_num_vertex_repulsive_fields = 0; // VertexRepulsive metric: Fields kept in memory, computed on demand. 0 stores all fields, otherwise at least 2 (start and end of a path).
+        HarmonicSolverMethod vertex_repulsive_solver = HarmonicSolverMethod::Direct; // VertexRepulsive metric: Iterative needs much less memory. Direct falls back to Iterative if the factorization fails.
+    };
+    const ShortestPathSettings& shortest_path_settings() const;
+    void set_shortest_path_settings(const ShortestPathSettings& _settings); // Copies of this Embedding inherit the settings
+
     VirtualPath find_shortest_path(
         const pm::halfedge_handle& _t_h_sector_start, // Target halfedge, at the beginning of a sector
         const pm::halfedge_handle& _t_h_sector_end,   // Target halfedge, at the beginning of a sector
-        ShortestPathMetric _metric = ShortestPathMetric::Geodesic
+        ShortestPathMetric _metric = ShortestPathMetric::Geodesic,
+        ShortestPathWorkspace* _workspace = nullptr   // Scratch memory. If nullptr, a thread-local workspace is used.
     ) const;
     VirtualPath find_shortest_path(
         const pm::halfedge_handle& _l_he, // Layout halfedge
@@ -62,6 +87,15 @@ public:
         ShortestPathMetric _metric = ShortestPathMetric::Geodesic
     ) const;
 
+    /// One-to-many version of find_shortest_path() for unembedded layout halfedges that start at the same layout vertex.
+    /// Halfedges that share a start sector are handled by a single Dijkstra search (Geodesic metric only).
+    /// Returns one path per halfedge, in the same order (empty if there is none).
+    std::vector<VirtualPath> find_shortest_paths(
+        const std::vector<pm::halfedge_handle>& _l_hes, // Layout halfedges
+        ShortestPathMetric _metric = ShortestPathMetric::Geodesic,
+        ShortestPathWorkspace* _workspace = nullptr
+    ) const;
+
     double path_length(const VirtualPath& _path) const;
 
     void embed_path(const pm::halfedge_handle& _l_he, const VirtualPath& _path);
@@ -76,12 +110,18 @@ public:
     double total_embedded_path_length() const;
     bool is_complete() const;
 
+    /// Rebuilds the embedded path index from the halfedge labels in O(total path length).
+    /// Has to be called after modifying the target mesh or the labels directly (e.g. via the non-const getters).
+    void update_embedded_paths();
+
     bool save(std::string filename, bool write_target_mesh=true,
               bool write_layout_mesh=true, bool write_target_input_mesh=true) const;
 
     bool load(std::string filename);
 
     // Getters.
+    const EmbeddingInput& embedding_input() const;
+    EmbeddingInput& embedding_input();
     const pm::Mesh& layout_mesh() const; // This will always refer to the original l_m in the input
     const pm::vertex_attribute<tg::pos3>& layout_pos() const;
     pm::vertex_attribute<tg::pos3>& layout_pos();
@@ -97,7 +137,60 @@ public:
     double get_vertex_repulsive_energy(const pm::vertex_handle& _t_v, const pm::vertex_handle& _l_v) const;
     double get_vertex_repulsive_energy(const VirtualVertex& _t_vv, const pm::vertex_handle& _l_v) const;
 
+    /// Undo log for tentative modifications.
+    /// After checkpoint(), embed_path(VirtualPath) and unembed_path() record all changes they make to the target mesh
+    /// and the embedded paths. rollback() reverts them exactly (including all element indices) in O(changes),
+    /// commit() keeps them and stops recording.
+    /// Checkpoints can be nested. Only the outermost commit() discards the undo log.
+    /// Not supported: embed_path(Snake) and writes via the non-const getters.
+    struct Checkpoint
+    {
+        size_t log_size = 0;
+        int num_vertices = 0;
+        int num_edges = 0;
+        int num_faces = 0;
+        int num_embedded_paths = 0;
+        double total_embedded_path_length = 0.0;
+        bool had_vertex_repulsive_energy = false;
+        std::shared_ptr<const ShortestPathLandmarks> landmarks; // Valid for the mesh at the checkpoint
+        bool outermost = false;
+    };
+    Checkpoint checkpoint();
+    void rollback(const Checkpoint& _cp);
+    void commit(const Checkpoint& _cp);
+    bool is_recording() const;
+
 private:
+    void copy_from(const Embedding& _em, EmbeddingInput& _input);
+
+    void record_halfedge(const pm::halfedge_handle& _t_h);
+    void record_vertex(const pm::vertex_handle& _t_v);
+    void record_face(const pm::face_handle& _t_f);
+    void record_matching_layout_halfedge(const pm::halfedge_handle& _t_h);
+    void record_split(const pm::edge_handle& _t_e);
+    void record_embedded_path(const pm::edge_index& _l_e);
+
+    // Target virtual vertices that are reachable from the vertex of the sector starting at t_he_sector
+    std::vector<VirtualVertex> get_virtual_vertices_in_sector(const pm::halfedge_handle& t_he_sector) const;
+
+    // See find_shortest_paths()
+    std::vector<VirtualPath> find_shortest_paths_from_sector(
+        const pm::halfedge_handle& _t_h_sector_start,
+        const std::vector<pm::halfedge_handle>& _t_h_sector_ends,
+        ShortestPathWorkspace* _workspace) const;
+
+    // See find_shortest_path(). Only defined in Embedding.cc.
+    template <typename LegalStep, typename LowerBound>
+    VirtualPath find_shortest_path_bidirectional(
+        const VirtualVertex& _vv_start,
+        const VirtualVertex& _vv_end,
+        const LegalStep& _legal_step,
+        const LowerBound& _distance_lower_bound,
+        ShortestPathWorkspace& _ws) const;
+
+    void set_embedded_path(const pm::halfedge_handle& _l_he, const std::vector<pm::vertex_handle>& _t_vertex_path);
+    void clear_embedded_path(const pm::edge_index& _l_e);
+
     EmbeddingInput* input;
     pm::Mesh t_m; // Target mesh. Copy.
     pm::vertex_attribute<tg::pos3> t_pos; // Target mesh positions. Copy.
@@ -106,9 +199,55 @@ private:
     pm::vertex_attribute<pm::vertex_handle> t_matching_vertex;
     pm::halfedge_attribute<pm::halfedge_handle> t_matching_halfedge;
 
+    // Index of the embedded paths, mirrors t_matching_halfedge.
+    // Updated by embed_path() and unembed_path(), so is_embedded() is O(1) and get_embedded_path() is O(path).
+    struct EmbeddedPath
+    {
+        std::vector<pm::vertex_index> vertices; // Along halfedgeA of the layout edge. Empty if not embedded.
+        pm::halfedge_index t_h_A; // First target halfedge of the path along halfedgeA
+        pm::halfedge_index t_h_B; // First target halfedge of the path along halfedgeB
+        double length = 0.0;
+    };
+    std::vector<EmbeddedPath> embedded_paths; // Indexed by layout edge
+    int num_embedded_paths = 0;
+    double total_length = 0.0;
+
     // Cache for the energy used for vertex repulsive path tracing [Praun2001].
     // Computed lazily when required. Access via get_vertex_repulsive_energy.
-    mutable std::optional<pm::vertex_attribute<Eigen::VectorXd>> vertex_repulsive_energy;
+    // The lazy initialization is thread-safe, so const methods can be called concurrently.
+    mutable std::optional<VertexRepulsiveEnergy> vertex_repulsive_energy;
+    mutable std::atomic<bool> vertex_repulsive_energy_ready{false};
+    mutable std::mutex vertex_repulsive_energy_mutex;
+    void reset_vertex_repulsive_energy(); // After modifying the target mesh other than via embed_path(VirtualPath)
+
+    ShortestPathSettings sp_settings;
+
+    // Landmark distances for the ALT heuristic. Computed lazily on the first query that requires them (thread-safe).
+    // Only valid for the target mesh they were computed on: Shared among copies, dropped whenever the target mesh is refined.
+    std::shared_ptr<const ShortestPathLandmarks> get_landmarks() const;
+    void reset_landmarks();
+    mutable std::shared_ptr<const ShortestPathLandmarks> landmarks;
+    mutable std::mutex landmarks_mutex;
+
+    // Pre-images of modified elements, see checkpoint().
+    // Elements created since a checkpoint are not recorded, they are removed from the end of the mesh on rollback.
+    struct UndoRecord
+    {
+        enum class Type
+        {
+            Halfedge,                // value = {to_vertex, face, next_halfedge, prev_halfedge}
+            Vertex,                  // value[0] = outgoing_halfedge
+            Face,                    // value[0] = halfedge
+            MatchingLayoutHalfedge,  // value[0] = layout halfedge
+            EmbeddedPath,            // idx = layout edge, value[0] = position in undo_embedded_paths
+        };
+        Type type;
+        int idx;
+        int value[4];
+    };
+    std::vector<UndoRecord> undo_log;
+    std::vector<EmbeddedPath> undo_embedded_paths;
+    bool recording = false;
 };
 
 }
@@ -4,13 +4,48 @@
 #include <LayoutEmbedding/VirtualPathConflictSentinel.hh>
 #include <LayoutEmbedding/Util/Assert.hh>
 
+#include <exception>
+
 namespace LayoutEmbedding {
 
+namespace {
+
+// Seeds of hash() and verification_hash()
+constexpr HashValue path_seed = 0x6a09e667f3bcc908ull;
+constexpr HashValue verification_seed = 0xbb67ae8584caa73bull;
+
+// Hashes the embedded path of _l_e (along halfedgeA) with both seeds.
+// Vertex positions are used instead of indices, since the latter depend on the insertion order.
+std::pair<HashValue, HashValue> embedded_path_fingerprints(const Embedding& _em, const pm::edge_handle& _l_e)
+{
+    HashValue h = hash_mix(path_seed ^ (HashValue)_l_e.idx.value);
+    HashValue h_verification = hash_mix(verification_seed ^ (HashValue)_l_e.idx.value);
+    for (const auto& t_v : _em.get_embedded_path(_l_e.halfedgeA())) {
+        const auto& pos = _em.target_pos()[t_v];
+        for (const auto& coord : {pos.x, pos.y, pos.z}) {
+            const HashValue x = LayoutEmbedding::hash(coord);
+            h = hash_mix(h ^ x);
+            h_verification = hash_mix(h_verification + x);
+        }
+    }
+    return {h, h_verification};
+}
+
+}
+
 EmbeddingState::EmbeddingState(const Embedding& _em, const BranchAndBoundSettings& _settings) :
     em(_em),
     candidate_paths(_em.layout_mesh()),
+    conflicts(_em.layout_mesh().all_edges().size()),
     settings(&_settings)
 {
+    for (const auto l_e : em.layout_mesh().edges()) {
+        if (em.is_embedded(l_e)) {
+            const auto [h, h_verification] = embedded_path_fingerprints(em, l_e);
+            path_fingerprint ^= h;
+            path_verification_fingerprint ^= h_verification;
+        }
+    }
 }
 
 void EmbeddingState::extend(const pm::edge_index& _l_ei, const VirtualPath& _path)
@@ -26,32 +61,233 @@ void EmbeddingState::extend(const pm::edge_index& _l_ei, const VirtualPath& _pat
     LE_ASSERT(real_vertex(_path.front()) == em.matching_target_vertex(l_he.vertex_from()));
     LE_ASSERT(real_vertex(_path.back())  == em.matching_target_vertex(l_he.vertex_to()));
 
+    if (conflict_sentinel.has_value() && !dirty_candidates.count(_l_ei) && candidate_paths[l_e] == _path) {
+        // Embedding the path only refines target elements that it shares with conflicting candidate paths.
+        // All other paths in the sentinel remain valid.
+        save_dirty_candidates();
+        dirty_candidates.insert(_l_ei);
+        for (const auto& l_ei_conflicting : conflict_sentinel->conflict_relation.neighbors(_l_ei)) {
+            dirty_candidates.insert(l_ei_conflicting);
+        }
+    }
+    else {
+        save_sentinel();
+        save_dirty_candidates();
+        conflict_sentinel.reset();
+        dirty_candidates.clear();
+    }
+
     em.embed_path(l_he, _path);
     insertion_sequence.push_back(_l_ei);
+
+    const auto [h, h_verification] = embedded_path_fingerprints(em, l_e);
+    path_fingerprint ^= h;
+    path_verification_fingerprint ^= h_verification;
+    sequence_fingerprint = hash_combine(sequence_fingerprint, _l_ei.value);
+}
+
+EmbeddingState::Checkpoint EmbeddingState::checkpoint()
+{
+    LE_ASSERT(!undo.active);
+
+    Checkpoint cp;
+    cp.em_cp = em.checkpoint();
+    cp.insertion_sequence_size = insertion_sequence.size();
+    cp.path_fingerprint = path_fingerprint;
+    cp.path_verification_fingerprint = path_verification_fingerprint;
+    cp.sequence_fingerprint = sequence_fingerprint;
+    undo.active = true;
+    return cp;
+}
+
+void EmbeddingState::rollback(const Checkpoint& _cp)
+{
+    LE_ASSERT(undo.active);
+
+    em.rollback(_cp.em_cp);
+    LE_ASSERT_GEQ(insertion_sequence.size(), _cp.insertion_sequence_size);
+    insertion_sequence.resize(_cp.insertion_sequence_size);
+    path_fingerprint = _cp.path_fingerprint;
+    path_verification_fingerprint = _cp.path_verification_fingerprint;
+    sequence_fingerprint = _cp.sequence_fingerprint;
+
+    for (auto it = undo.candidate_paths.rbegin(); it != undo.candidate_paths.rend(); ++it) {
+        candidate_paths[it->first] = std::move(it->second);
+    }
+    if (undo.dirty_candidates.has_value()) {
+        dirty_candidates = std::move(*undo.dirty_candidates);
+    }
+    if (undo.conflicts.has_value()) {
+        conflicts = std::move(*undo.conflicts);
+    }
+    if (undo.conflict_sentinel.has_value()) {
+        conflict_sentinel = std::move(*undo.conflict_sentinel);
+    }
+
+    // Re-insert the checkpoint's paths of all labels that were touched. The target mesh has been rolled back,
+    // so they cover the same elements as before.
+    if (conflict_sentinel.has_value() && !undo.sentinel_labels.empty()) {
+        std::set<pm::edge_index> l_eis_touched;
+        std::set<pm::edge_index> l_eis_contained;
+        for (const auto& [l_ei, contained] : undo.sentinel_labels) {
+            if (l_eis_touched.insert(l_ei).second && contained) {
+                l_eis_contained.insert(l_ei);
+            }
+        }
+
+        // The sentinel doesn't store the paths. Those of dirty candidates are unknown, so rebuild it from scratch then.
+        bool restorable = true;
+        for (const auto& l_ei : l_eis_contained) {
+            if (dirty_candidates.count(l_ei)) {
+                restorable = false;
+            }
+        }
+
+        if (restorable) {
+            std::set<pm::vertex_index> l_vs_affected;
+            for (const auto& l_ei : l_eis_touched) {
+                if (conflict_sentinel->contains(l_ei)) {
+                    conflict_sentinel->remove_path(l_ei);
+                }
+                const auto l_e = em.layout_mesh().edges()[l_ei];
+                l_vs_affected.insert(l_e.vertexA());
+                l_vs_affected.insert(l_e.vertexB());
+            }
+            for (const auto& l_ei : l_eis_contained) {
+                conflict_sentinel->insert_path(em, candidate_paths[l_ei], l_ei);
+            }
+            for (const auto& l_vi : l_vs_affected) {
+                conflict_sentinel->check_path_ordering(em, em.layout_mesh()[l_vi]);
+            }
+        }
+        else {
+            conflict_sentinel.reset();
+            dirty_candidates.clear();
+        }
+    }
+
+    undo = UndoLog();
+    undo.active = true;
+}
+
+void EmbeddingState::commit(const Checkpoint& _cp)
+{
+    LE_ASSERT(undo.active);
+    em.commit(_cp.em_cp);
+    undo = UndoLog();
+}
+
+void EmbeddingState::save_candidate_path(const pm::edge_index& _l_ei)
+{
+    if (undo.active) {
+        undo.candidate_paths.emplace_back(_l_ei, candidate_paths[_l_ei]);
+    }
+}
+
+void EmbeddingState::save_sentinel_label(const pm::edge_index& _l_ei)
+{
+    // Labels of a replacement sentinel don't matter, it is discarded by rollback()
+    if (undo.active && !undo.conflict_sentinel.has_value()) {
+        undo.sentinel_labels.emplace_back(_l_ei, conflict_sentinel->contains(_l_ei));
+    }
+}
+
+void EmbeddingState::save_sentinel()
+{
+    if (undo.active && !undo.conflict_sentinel.has_value()) {
+        undo.conflict_sentinel.emplace(std::move(conflict_sentinel));
+        conflict_sentinel.reset();
+    }
+}
+
+void EmbeddingState::save_conflicts()
+{
+    if (undo.active && !undo.conflicts.has_value()) {
+        undo.conflicts.emplace(std::move(conflicts));
+        conflicts = ConflictGraph(em.layout_mesh().all_edges().size());
+    }
+}
+
+void EmbeddingState::save_dirty_candidates()
+{
+    if (undo.active && !undo.dirty_candidates.has_value()) {
+        undo.dirty_candidates.emplace(dirty_candidates);
+    }
 }
 
 void EmbeddingState::compute_candidate_path(const pm::edge_index& _l_ei)
 {
-    const Embedding& c_em = em; // We don't want to modify the embedding in this method.
-    const auto& l_e = c_em.layout_mesh().edges()[_l_ei];
+    compute_candidate_paths({_l_ei});
+}
 
+void EmbeddingState::compute_candidate_paths(const std::vector<pm::edge_index>& _l_eis)
+{
+    const Embedding& c_em = em; // We don't want to modify the embedding in this method.
     LE_ASSERT(&candidate_paths.mesh() == &c_em.layout_mesh());
-    LE_ASSERT(!em.is_embedded(l_e));
 
-    auto l_he = l_e.halfedgeA();
-    auto path = c_em.find_shortest_path(l_he);
+    save_dirty_candidates();
+    dirty_candidates.insert(_l_eis.begin(), _l_eis.end());
+    for (const auto& l_ei : _l_eis) {
+        save_candidate_path(l_ei);
+    }
 
-    candidate_paths[l_e] = path;
+    // The shortest path searches are independent const queries on em.
+    // Each thread writes to a different element of candidate_paths.
+    std::exception_ptr exception;
+    #pragma omp parallel for schedule(dynamic) if(settings->use_parallel_candidate_paths && _l_eis.size() > 1)
+    for (int i = 0; i < (int)_l_eis.size(); ++i) {
+        try {
+            const auto& l_e = c_em.layout_mesh().edges()[_l_eis[i]];
+            LE_ASSERT(!c_em.is_embedded(l_e));
+            candidate_paths[l_e] = c_em.find_shortest_path(l_e.halfedgeA());
+        }
+        catch (...) {
+            #pragma omp critical
+            {
+                if (!exception) {
+                    exception = std::current_exception();
+                }
+            }
+        }
+    }
+    if (exception) {
+        std::rethrow_exception(exception);
+    }
 }
 
 void EmbeddingState::compute_all_candidate_paths()
 {
     const Embedding& c_em = em; // We don't want to modify the embedding in this method.
 
+    for (const auto l_e : c_em.layout_mesh().edges()) {
+        if (!candidate_paths[l_e].empty()) {
+            save_candidate_path(l_e);
+        }
+    }
+    save_sentinel();
+    save_dirty_candidates();
     candidate_paths.clear();
+    conflict_sentinel.reset();
+    dirty_candidates.clear();
+
+    std::vector<pm::edge_index> l_eis;
     for (const auto l_e : c_em.layout_mesh().edges()) {
         if (!c_em.is_embedded(l_e)) {
-            compute_candidate_path(l_e);
+            l_eis.push_back(l_e);
+        }
+    }
+    compute_candidate_paths(l_eis);
+}
+
+void EmbeddingState::set_candidate_paths(const std::vector<VirtualPath>& _paths)
+{
+    LE_ASSERT_EQ(_paths.size(), em.layout_mesh().all_edges().size());
+    for (const auto l_e : em.layout_mesh().edges()) {
+        if (candidate_paths[l_e] != _paths[l_e.idx.value]) {
+            save_candidate_path(l_e);
+            save_dirty_candidates();
+            candidate_paths[l_e] = _paths[l_e.idx.value];
+            dirty_candidates.insert(l_e);
         }
     }
 }
@@ -59,37 +295,63 @@ void EmbeddingState::compute_all_candidate_paths()
 void EmbeddingState::detect_candidate_path_conflicts()
 {
     const Embedding& c_em = em; // We don't want to modify the embedding in this method.
-    conflicts.clear();
 
-    if (valid()) {
-        VirtualPathConflictSentinel vpcs(c_em);
+    save_conflicts();
+    save_dirty_candidates();
+
+    if (!valid()) {
+        save_sentinel();
+        conflicts.clear();
+        conflict_sentinel.reset();
+        dirty_candidates.clear();
+        return;
+    }
+
+    if (!conflict_sentinel.has_value()) {
+        // Full rebuild
+        save_sentinel();
+        conflict_sentinel.emplace(c_em);
         for (const auto l_e : c_em.layout_mesh().edges()) {
             if (!c_em.is_embedded(l_e)) {
                 const auto& path = candidate_paths[l_e];
                 LE_ASSERT(!path.empty());
-                vpcs.insert_path(path, l_e);
+                conflict_sentinel->insert_path(c_em, path, l_e);
+            }
+        }
+        conflict_sentinel->check_path_ordering(c_em);
+    }
+    else {
+        // Re-insert the changed paths and recheck the ordering at their endpoints
+        std::set<pm::vertex_index> l_vs_affected;
+        for (const auto& l_ei : dirty_candidates) {
+            save_sentinel_label(l_ei);
+            if (conflict_sentinel->contains(l_ei)) {
+                conflict_sentinel->remove_path(l_ei);
+            }
+            const auto l_e = c_em.layout_mesh().edges()[l_ei];
+            l_vs_affected.insert(l_e.vertexA());
+            l_vs_affected.insert(l_e.vertexB());
+        }
+        for (const auto& l_ei : dirty_candidates) {
+            if (!c_em.is_embedded(l_ei)) {
+                const auto& path = candidate_paths[l_ei];
+                LE_ASSERT(!path.empty());
+                conflict_sentinel->insert_path(c_em, path, l_ei);
             }
         }
-        vpcs.check_path_ordering();
-        conflicts = vpcs.conflict_relation;
+        for (const auto& l_vi : l_vs_affected) {
+            conflict_sentinel->check_path_ordering(c_em, c_em.layout_mesh()[l_vi]);
+        }
     }
+    dirty_candidates.clear();
+    conflicts = conflict_sentinel->conflict_relation;
 
     LE_ASSERT_EQ(c_em.layout_mesh().edges().size(), embedded_edges().size() + conflicting_edges().size() + non_conflicting_edges().size());
 }
 
 std::vector<pm::edge_index> EmbeddingState::get_conflicting_candidates(const pm::edge_index& _l_ei)
 {
-    std::vector<pm::edge_index> result;
-    for (const auto& [l_ei_A, l_ei_B] : conflicts) {
-        LE_ASSERT(l_ei_A != l_ei_B);
-        if (_l_ei == l_ei_A) {
-            result.push_back(l_ei_B);
-        }
-        else if (_l_ei == l_ei_B) {
-            result.push_back(l_ei_A);
-        }
-    }
-    return result;
+    return conflicts.neighbors(_l_ei);
 }
 
 bool EmbeddingState::valid() const
@@ -142,73 +404,84 @@ double EmbeddingState::unembedded_cost() const
 }
 
 HashValue EmbeddingState::hash() const
+{
+    if (!settings->use_state_hashing) {
+        return path_fingerprint ^ sequence_fingerprint;
+    }
+    return path_fingerprint;
+}
+
+HashValue EmbeddingState::verification_hash() const
+{
+    if (!settings->use_state_hashing) {
+        return path_verification_fingerprint ^ hash_mix(sequence_fingerprint);
+    }
+    return path_verification_fingerprint;
+}
+
+HashValue EmbeddingState::recompute_hash() const
 {
     HashValue h = 0;
     for (const auto l_e : em.layout_mesh().edges()) {
         if (em.is_embedded(l_e)) {
-            const auto& path = em.get_embedded_path(l_e.halfedgeA());
-            for (const auto& t_v : path) {
-                const auto& pos = em.target_pos()[t_v];
-                h = hash_combine(h, LayoutEmbedding::hash(pos));
-            }
+            h ^= embedded_path_fingerprints(em, l_e).first;
         }
     }
     if (!settings->use_state_hashing) {
-        for (const auto& e_i : insertion_sequence) {
-            h = hash_combine(h, LayoutEmbedding::hash(e_i.value));
+        HashValue h_sequence = 0;
+        for (const auto& l_ei : insertion_sequence) {
+            h_sequence = hash_combine(h_sequence, l_ei.value);
         }
+        h ^= h_sequence;
     }
     return h;
 }
 
-std::set<pm::edge_index> EmbeddingState::embedded_edges() const
+std::vector<pm::edge_index> EmbeddingState::embedded_edges() const
 {
-    std::set<pm::edge_index> result;
+    std::vector<pm::edge_index> result;
     for (const auto l_e : em.layout_mesh().edges()) {
         if (em.is_embedded(l_e)) {
-            result.insert(l_e);
+            result.push_back(l_e);
         }
     }
     return result;
 }
 
-std::set<polymesh::edge_index> EmbeddingState::unembedded_edges() const
+std::vector<pm::edge_index> EmbeddingState::unembedded_edges() const
 {
-    std::set<pm::edge_index> result;
+    std::vector<pm::edge_index> result;
     for (const auto l_e : em.layout_mesh().edges()) {
         if (!em.is_embedded(l_e)) {
-            result.insert(l_e);
+            result.push_back(l_e);
         }
     }
     return result;
 }
 
-std::set<pm::edge_index> EmbeddingState::conflicting_edges() const
+std::vector<pm::edge_index> EmbeddingState::conflicting_edges() const
 {
-    std::set<pm::edge_index> result;
-    for (const auto& [l_ei_A, l_ei_B] : conflicts) {
-        LE_ASSERT(l_ei_A != l_ei_B);
-        LE_ASSERT(!em.is_embedded(l_ei_A));
-        LE_ASSERT(!em.is_embedded(l_ei_B));
-
-        result.insert(l_ei_A);
-        result.insert(l_ei_B);
+    const auto result = conflicts.conflicting_edges();
+    for (const auto& l_ei : result) {
+        LE_ASSERT(!em.is_embedded(l_ei));
     }
     return result;
 }
 
-std::set<pm::edge_index> EmbeddingState::non_conflicting_edges() const
+std::vector<pm::edge_index> EmbeddingState::non_conflicting_edges() const
 {
-    std::set<pm::edge_index> result;
-    const auto& conf = conflicting_edges();
+    std::vector<pm::edge_index> result;
     for (const auto l_e : em.layout_mesh().edges()) {
-        if (!em.is_embedded(l_e)) {
-            if (!conf.count(l_e)) {
-                result.insert(l_e);
-            }
+        if (!em.is_embedded(l_e) && !conflicts.is_conflicting(l_e)) {
+            result.push_back(l_e);
         }
     }
     return result;
 }
 
+int EmbeddingState::num_conflicting_edges() const
+{
+    return conflicts.num_conflicting_edges();
+}
+
 }
@@ -4,6 +4,7 @@
 #include <LayoutEmbedding/Embedding.hh>
 #include <LayoutEmbedding/Hash.hh>
 #include <LayoutEmbedding/InsertionSequence.hh>
+#include <LayoutEmbedding/VirtualPathConflictSentinel.hh>
 
 namespace LayoutEmbedding {
 
@@ -18,8 +19,30 @@ struct EmbeddingState
 
     void extend(const pm::edge_index& _l_ei, const VirtualPath& _path);
 
+    /// Tentative extensions, see Embedding::checkpoint().
+    /// rollback() also restores the insertion sequence, candidate paths, and conflicts.
+    /// Only the data changed since the checkpoint is recorded (see UndoLog), so both are cheap if little changed.
+    /// Checkpoints can't be nested.
+    struct Checkpoint
+    {
+        Embedding::Checkpoint em_cp;
+        size_t insertion_sequence_size = 0;
+        HashValue path_fingerprint = 0;
+        HashValue path_verification_fingerprint = 0;
+        HashValue sequence_fingerprint = 0;
+    };
+    Checkpoint checkpoint();
+    void rollback(const Checkpoint& _cp);
+    void commit(const Checkpoint& _cp);
+
     void compute_candidate_path(const pm::edge_index& _l_ei);
+    void compute_candidate_paths(const std::vector<pm::edge_index>& _l_eis); // In parallel, see BranchAndBoundSettings::use_parallel_candidate_paths
     void compute_all_candidate_paths();
+    void set_candidate_paths(const std::vector<VirtualPath>& _paths); // Indexed by layout edge
+
+    /// Updates conflicts. Only the candidate paths that changed since the last call are re-inserted into the
+    /// conflict sentinel, and the path ordering is only rechecked at their endpoints.
+    /// Falls back to a full rebuild if the sentinel cannot be updated incrementally.
     void detect_candidate_path_conflicts();
 
     std::vector<pm::edge_index> get_conflicting_candidates(const pm::edge_index& _l_ei);
@@ -29,20 +52,60 @@ struct EmbeddingState
     double embedded_cost() const;
     double unembedded_cost() const;
 
+    /// Fingerprint of the state. The embedded paths are hashed individually (by layout edge and vertex positions)
+    /// and combined via XOR, so the fingerprint is updated in O(path length) by extend() and does not depend on the
+    /// insertion order. If !use_state_hashing, the insertion sequence is hashed as well.
     HashValue hash() const;
 
+    /// Second fingerprint with independent seeds. Used to detect collisions of hash(), see BranchAndBoundSettings::verify_state_hashes.
+    HashValue verification_hash() const;
+
+    /// Computes hash() from scratch. For debugging.
+    HashValue recompute_hash() const;
+
     Embedding em;
     InsertionSequence insertion_sequence;
 
-    std::set<pm::edge_index> embedded_edges() const;
-    std::set<pm::edge_index> unembedded_edges() const;
-    std::set<pm::edge_index> conflicting_edges() const;
-    std::set<pm::edge_index> non_conflicting_edges() const;
+    // Classification of the layout edges. Results are in ascending order.
+    std::vector<pm::edge_index> embedded_edges() const;
+    std::vector<pm::edge_index> unembedded_edges() const;
+    std::vector<pm::edge_index> conflicting_edges() const;
+    std::vector<pm::edge_index> non_conflicting_edges() const;
+    int num_conflicting_edges() const;
 
     pm::edge_attribute<VirtualPath> candidate_paths;
-    std::set<std::pair<pm::edge_index, pm::edge_index>> conflicts;
+    ConflictGraph conflicts;
+
+    // Persistent conflict detection. Mirrors candidate_paths except for dirty_candidates.
+    // Reset if it can't be kept in sync (e.g. if candidate paths are replaced wholesale).
+    std::optional<VirtualPathConflictSentinel> conflict_sentinel;
+    std::set<pm::edge_index> dirty_candidates;
+
+    // Incremental fingerprints, see hash()
+    HashValue path_fingerprint = 0;
+    HashValue path_verification_fingerprint = 0;
+    HashValue sequence_fingerprint = 0;
 
     const BranchAndBoundSettings* settings;
+
+private:
+    // Changes since the active checkpoint, reverted by rollback()
+    struct UndoLog
+    {
+        bool active = false;
+        std::vector<std::pair<pm::edge_index, VirtualPath>> candidate_paths; // Replaced candidate paths, oldest first
+        std::vector<std::pair<pm::edge_index, bool>> sentinel_labels; // Labels removed from / inserted into the checkpoint's sentinel, and whether it contained them
+        std::optional<std::optional<VirtualPathConflictSentinel>> conflict_sentinel; // Set if the sentinel was replaced
+        std::optional<ConflictGraph> conflicts; // Set if the conflicts were replaced
+        std::optional<std::set<pm::edge_index>> dirty_candidates; // Set if the dirty candidates changed
+    };
+    UndoLog undo;
+
+    void save_candidate_path(const pm::edge_index& _l_ei); // Before overwriting it
+    void save_sentinel_label(const pm::edge_index& _l_ei); // Before removing it from / inserting it into the sentinel
+    void save_sentinel(); // Before replacing or resetting the sentinel
+    void save_conflicts(); // Before replacing the conflicts
+    void save_dirty_candidates(); // Before changing the dirty candidates
 };
 
 }
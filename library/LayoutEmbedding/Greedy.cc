@@ -1,167 +1,254 @@
 #include "Greedy.hh"
 
+#include <LayoutEmbedding/Connectivity.hh>
 #include <LayoutEmbedding/IGLMesh.hh>
 #include <LayoutEmbedding/UnionFind.hh>
 #include <LayoutEmbedding/VirtualPort.hh>
 #include <LayoutEmbedding/Util/Assert.hh>
 
+#include <omp.h>
+
 #include <algorithm>
+#include <array>
+#include <cmath>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <set>
 #include <queue>
+#include <unordered_map>
+#include <unordered_set>
 
 namespace LayoutEmbedding {
 
 namespace {
 
+/// Scratch buffers for swirl_detection(), reused across calls.
+/// Per-vertex entries are only valid if their stamp matches the current direction / search, so resets are O(1).
+struct SwirlWorkspace
+{
+    std::vector<int> indicator_stamp;
+    std::vector<int8_t> indicator;
+    std::vector<int> distance_stamp;
+    std::vector<double> distance;
+    std::vector<std::pair<double, int>> queue; // Min-heap of (distance, target vertex index)
+    int direction = 0;
+    int search = 0;
+
+    // Bounding box of all target vertices inspected by the current query
+    tg::pos3 explored_min;
+    tg::pos3 explored_max;
+
+    void begin_query(const pm::Mesh& _t_m)
+    {
+        const std::size_t n = _t_m.all_vertices().size();
+        if (indicator.size() < n) {
+            indicator_stamp.resize(n, 0);
+            indicator.resize(n, 0);
+            distance_stamp.resize(n, 0);
+            distance.resize(n, 0.0);
+        }
+        const float inf = std::numeric_limits<float>::infinity();
+        explored_min = {inf, inf, inf};
+        explored_max = {-inf, -inf, -inf};
+    }
+
+    void begin_direction()
+    {
+        ++direction;
+    }
+
+    void begin_search()
+    {
+        ++search;
+        queue.clear();
+    }
+
+    int get_indicator(const pm::vertex_handle& _t_v) const
+    {
+        return (indicator_stamp[_t_v.idx.value] == direction) ? indicator[_t_v.idx.value] : 0;
+    }
+
+    void set_indicator(const pm::vertex_handle& _t_v, const int _value)
+    {
+        indicator_stamp[_t_v.idx.value] = direction;
+        indicator[_t_v.idx.value] = _value;
+    }
+
+    double get_distance(const int _t_vi) const
+    {
+        return (distance_stamp[_t_vi] == search) ? distance[_t_vi] : std::numeric_limits<double>::infinity();
+    }
+
+    void set_distance(const int _t_vi, const double _value)
+    {
+        distance_stamp[_t_vi] = search;
+        distance[_t_vi] = _value;
+    }
+
+    void explore(const tg::pos3& _p)
+    {
+        explored_min = {std::min(explored_min.x, _p.x), std::min(explored_min.y, _p.y), std::min(explored_min.z, _p.z)};
+        explored_max = {std::max(explored_max.x, _p.x), std::max(explored_max.y, _p.y), std::max(explored_max.z, _p.z)};
+    }
+};
+
 /// Heuristic detection of paths that might introduce swirls after insertion.
 /// For each vertex around the face that is incident to _l_he on the left,
 /// a shortest path towards the given path is traced.
 /// If the path is hit from the right side (instead of the left), this is considered a potential swirl.
+/// The same test is then done for the face on the right on the reversed path.
+/// Each search stops at the first vertex next to the path, so its cost depends on the explored region only.
 /// Returns true if a potential swirl is detected, false otherwise.
-bool swirl_detection(Embedding& _em, const pm::halfedge_handle& _l_he, const VirtualPath& _path)
+bool swirl_detection(const Embedding& _em, const pm::halfedge_handle& _l_he, const VirtualPath& _path, SwirlWorkspace& _ws)
 {
-    const pm::Mesh& l_m = _em.layout_mesh();
     const pm::Mesh& t_m = _em.target_mesh();
     const pm::vertex_attribute<tg::pos3>& t_pos = _em.target_pos();
 
-    // Walk along the VertexEdgePath and mark the vertices directly left and right of it with a special attribute:
-    // The indicator attribute assigns each vertex a value in {-1, 0, 1},
-    // -1 meaning it is directly on the left of the arc,
-    // 1 meaning it is directly on the right of the arc,
-    // 0 otherwise.
-    pm::vertex_attribute<int> t_indicator(t_m);
+    _ws.begin_query(t_m);
 
     LE_ASSERT(is_real_vertex(_path.front()));
     LE_ASSERT(is_real_vertex(_path.back()));
 
-    for (int i = 0; i < _path.size(); ++i) {
-        const auto& vv = _path[i];
-
-        if (is_real_vertex(vv)) {
-            if (i > 0 && i < _path.size() - 1) {
-                const auto& el_prev = _path[i - 1];
-                const auto& el_next = _path[i + 1];
-                const auto& v = real_vertex(vv, t_m);
-
-                VirtualPort vh_start{v, el_prev};
-                VirtualPort vh_end{v, el_next};
+    auto mark = [&](const pm::vertex_handle& _t_v, const int _value) {
+        _ws.set_indicator(_t_v, _value);
+        _ws.explore(t_pos[_t_v]);
+    };
 
-                auto vh_current = vh_start.rotated_cw();
-                while (vh_current != vh_end) {
-                    if (is_real_vertex(vh_current.to)) {
-                        const auto& v_to = real_vertex(vh_current.to);
-                        t_indicator[v_to] = -1; // "Left"
+    // Walk along the VertexEdgePath (reversed if _reversed) and mark the vertices directly left and right of it:
+    // The indicator assigns each vertex a value in {-1, 0, 1},
+    // -1 meaning it is directly on the left of the arc,
+    // 1 meaning it is directly on the right of the arc,
+    // 0 otherwise.
+    // Later marks overwrite earlier ones, so each direction needs its own pass.
+    auto mark_sides = [&](const bool _reversed) {
+        _ws.begin_direction();
+        const int n = _path.size();
+        auto at = [&](const int _i) -> const VirtualVertex& {
+            return _reversed ? _path[n - 1 - _i] : _path[_i];
+        };
+
+        for (int i = 0; i < n; ++i) {
+            const auto& vv = at(i);
+
+            if (is_real_vertex(vv)) {
+                if (i > 0 && i < n - 1) {
+                    const auto& el_prev = at(i - 1);
+                    const auto& el_next = at(i + 1);
+                    const auto& v = real_vertex(vv, t_m);
+
+                    VirtualPort vh_start{v, el_prev};
+                    VirtualPort vh_end{v, el_next};
+
+                    auto vh_current = vh_start.rotated_cw();
+                    while (vh_current != vh_end) {
+                        if (is_real_vertex(vh_current.to)) {
+                            mark(real_vertex(vh_current.to, t_m), -1); // "Left"
+                        }
+                        vh_current = vh_current.rotated_cw();
                     }
-                    vh_current = vh_current.rotated_cw();
-                }
 
-                while (vh_current != vh_start) {
-                    if (is_real_vertex(vh_current.to)) {
-                        const auto& v_to = real_vertex(vh_current.to);
-                        t_indicator[v_to] = 1; // "Right"
+                    while (vh_current != vh_start) {
+                        if (is_real_vertex(vh_current.to)) {
+                            mark(real_vertex(vh_current.to, t_m), 1); // "Right"
+                        }
+                        vh_current = vh_current.rotated_cw();
                     }
-                    vh_current = vh_current.rotated_cw();
                 }
             }
-        }
-        else if (is_real_edge(vv)) {
-            LE_ASSERT_G(i, 0);
-            LE_ASSERT_L(i, _path.size() - 1);
-
-            const auto& e = real_edge(vv, t_m);
-            auto he = pm::halfedge_handle::invalid;
-
-            const auto& vv_next = _path[i + 1];
-            if (is_real_vertex(vv_next)) {
-                const auto& v_next = real_vertex(vv_next);
-                if (e.halfedgeA().next().vertex_to() == v_next) {
-                    he = e.halfedgeA();
-                }
-                else if (e.halfedgeB().next().vertex_to() == v_next) {
-                    he = e.halfedgeB();
+            else if (is_real_edge(vv)) {
+                LE_ASSERT_G(i, 0);
+                LE_ASSERT_L(i, n - 1);
+
+                const auto& e = real_edge(vv, t_m);
+                auto he = pm::halfedge_handle::invalid;
+
+                const auto& vv_next = at(i + 1);
+                if (is_real_vertex(vv_next)) {
+                    const auto& v_next = real_vertex(vv_next);
+                    if (e.halfedgeA().next().vertex_to() == v_next) {
+                        he = e.halfedgeA();
+                    }
+                    else if (e.halfedgeB().next().vertex_to() == v_next) {
+                        he = e.halfedgeB();
+                    }
                 }
-            }
-            else if (is_real_edge(vv_next)) {
-                const auto& e_next = real_edge(vv_next, t_m);
+                else if (is_real_edge(vv_next)) {
+                    const auto& e_next = real_edge(vv_next, t_m);
 
-                if ((e.halfedgeA().face() == e_next.halfedgeA().face()) || (e.halfedgeA().face() == e_next.halfedgeB().face())) {
-                    he = e.halfedgeA();
-                }
-                else if ((e.halfedgeB().face() == e_next.halfedgeA().face()) || (e.halfedgeB().face() == e_next.halfedgeB().face())) {
-                    he = e.halfedgeB();
+                    if ((e.halfedgeA().face() == e_next.halfedgeA().face()) || (e.halfedgeA().face() == e_next.halfedgeB().face())) {
+                        he = e.halfedgeA();
+                    }
+                    else if ((e.halfedgeB().face() == e_next.halfedgeA().face()) || (e.halfedgeB().face() == e_next.halfedgeB().face())) {
+                        he = e.halfedgeB();
+                    }
                 }
-            }
 
-            LE_ASSERT(he.is_valid());
-            t_indicator[he.vertex_from()] = -1; // "Left"
-            t_indicator[he.vertex_to()] = 1; // "Right"
+                LE_ASSERT(he.is_valid());
+                mark(he.vertex_from(), -1); // "Left"
+                mark(he.vertex_to(), 1); // "Right"
+            }
         }
-    }
+    };
 
     // Start a shortest-path search from the seed vertices and see whether it first meets a vertex marked "Left" (good) or "Right" (bad)
+    auto search = [&](const pm::halfedge_handle& _l_he_seed) {
+        _ws.begin_search();
+        auto& q = _ws.queue;
+        const auto cmp = std::greater<std::pair<double, int>>();
 
-    struct Candidate
-    {
-        double distance;
-        pm::vertex_handle v;
-
-        bool operator<(const Candidate& _rhs) const
-        {
-            return distance > _rhs.distance;
-        }
-    };
-
-    pm::vertex_attribute<double> distance(t_m, std::numeric_limits<double>::infinity());
-    std::priority_queue<Candidate> q;
-    std::vector<pm::vertex_handle> t_seed_vertices;
-    const auto& l_f = _l_he.face();
-    for (const auto l_v : l_f.vertices()) {
-        if ((l_v == _l_he.vertex_from()) || (l_v == _l_he.vertex_to())) {
-            continue;
+        for (const auto l_v : _l_he_seed.face().vertices()) {
+            if ((l_v == _l_he_seed.vertex_from()) || (l_v == _l_he_seed.vertex_to())) {
+                continue;
+            }
+            const auto t_v = _em.matching_target_vertex(l_v);
+            _ws.set_distance(t_v.idx.value, 0.0);
+            q.push_back({0.0, t_v.idx.value});
+            std::push_heap(q.begin(), q.end(), cmp);
         }
-        const auto t_v = _em.matching_target_vertex(l_v);
-        t_seed_vertices.push_back(t_v);
-        distance[t_v] = 0.0;
-        q.push({0.0, t_v});
-    }
 
-    while (!q.empty()) {
-        const auto c = q.top();
-        q.pop();
+        while (!q.empty()) {
+            std::pop_heap(q.begin(), q.end(), cmp);
+            const auto [d, t_vi] = q.back();
+            q.pop_back();
+            if (d > _ws.get_distance(t_vi)) {
+                continue; // Outdated entry
+            }
 
-        if (t_indicator[c.v] == -1) {
-            // We arrived on the correct (left) side of the path. Probably no spiral.
-            return false;
-        }
-        else if (t_indicator[c.v] == 1) {
-            // We arrived on the wrong (right) side of the path. Spiral detected.
-            return true;
-        }
+            const auto t_v = t_m.vertices()[t_vi];
+            _ws.explore(t_pos[t_v]);
+            const int indicator = _ws.get_indicator(t_v);
+            if (indicator == -1) {
+                // We arrived on the correct (left) side of the path. Probably no spiral.
+                return false;
+            }
+            else if (indicator == 1) {
+                // We arrived on the wrong (right) side of the path. Spiral detected.
+                return true;
+            }
 
-        for (const auto he : c.v.outgoing_halfedges()) {
-            const auto& v_to = he.vertex_to();
-            const double new_distance = distance[c.v] + tg::distance(t_pos[c.v], t_pos[v_to]);
-            if (new_distance < distance[v_to]) {
-                distance[v_to] = new_distance;
-                q.push({new_distance, v_to});
+            for (const auto he : t_v.outgoing_halfedges()) {
+                const auto& v_to = he.vertex_to();
+                const double new_distance = d + tg::distance(t_pos[t_v], t_pos[v_to]);
+                if (new_distance < _ws.get_distance(v_to.idx.value)) {
+                    _ws.set_distance(v_to.idx.value, new_distance);
+                    q.push_back({new_distance, v_to.idx.value});
+                    std::push_heap(q.begin(), q.end(), cmp);
+                }
             }
         }
-    }
-    // This will likely be never reached
-    return false;
-}
+        // This will likely be never reached
+        return false;
+    };
 
-bool swirl_detection_bidirectional(Embedding& _em, const pm::halfedge_handle& _l_he, const VirtualPath& _path)
-{
-    if (swirl_detection(_em, _l_he, _path)) {
+    mark_sides(false);
+    if (search(_l_he)) {
         return true;
     }
-    else {
-        const auto l_he_opp = _l_he.opposite();
-        auto path_opp = _path;
-        std::reverse(path_opp.begin(), path_opp.end());
-        return swirl_detection(_em, l_he_opp, path_opp);
-    }
+    mark_sides(true);
+    return search(_l_he.opposite());
 }
 
 /// [Kraevoy2003] / [Kraevoy2004] blocking condition.
@@ -239,21 +326,635 @@ bool is_blocking(const Embedding& _em, const pm::halfedge_handle& _l_h_seed)
 
 /// [Kraevoy2003] / [Kraevoy2004] blocking condition.
 /// Check if sets of layout vertices left and right of path match between layout and target mesh.
-/// _l_e is not yet embedded.
-bool is_blocking(const Embedding& _em, const pm::edge_handle& _l_e, const VirtualPath& _path)
+/// _l_e is not yet embedded. _em is modified temporarily and restored before returning.
+bool is_blocking_embedded(Embedding& _em, const pm::edge_handle& _l_e, const VirtualPath& _path)
 {
     LE_ASSERT(!_em.is_embedded(_l_e));
 
-    // Copy embedding to temporarily embed the path
-    Embedding em_copy = _em;
-    em_copy.embed_path(_l_e.halfedgeA(), _path);
+    // Temporarily embed the path
+    const auto cp = _em.checkpoint();
+    _em.embed_path(_l_e.halfedgeA(), _path);
+
+    const bool blocking = is_blocking(_em, _l_e.halfedgeA()) || is_blocking(_em, _l_e.halfedgeB());
 
-    return is_blocking(em_copy, _l_e.halfedgeA()) || is_blocking(em_copy, _l_e.halfedgeB());
+    _em.rollback(cp);
+    _em.commit(cp);
+    return blocking;
 }
 
+/// Scratch buffers for is_blocking_virtual(), reused across calls.
+/// Visited flags are only valid if their stamp matches the current flood fill, so resets are O(1).
+struct BlockingWorkspace
+{
+    // Face split by the path. Corners are listed in halfedge order, starting at the first halfedge of the face.
+    // Piece -1 marks a corner on the path.
+    struct FaceSplit
+    {
+        std::array<int, 3> corners;
+        std::array<int, 3> pieces;
+    };
+    std::unordered_map<int, FaceSplit> t_splits;
+    std::unordered_set<int> t_crossed_edges; // Midpoint on the path
+    std::unordered_set<int> t_path_edges; // Path runs along the edge
+    std::unordered_set<int> t_path_vertices;
+
+    std::vector<int> l_visited; // Per layout face
+    std::vector<int> t_visited; // Per (target face, piece)
+    int fill = 0;
+    std::vector<pm::face_handle> l_stack;
+    std::vector<std::pair<int, int>> t_stack;
+
+    void begin_query(const pm::Mesh& _l_m, const pm::Mesh& _t_m)
+    {
+        if (l_visited.size() < _l_m.all_faces().size()) {
+            l_visited.resize(_l_m.all_faces().size(), 0);
+        }
+        if (t_visited.size() < 2 * _t_m.all_faces().size()) {
+            t_visited.resize(2 * _t_m.all_faces().size(), 0);
+        }
+        t_splits.clear();
+        t_crossed_edges.clear();
+        t_path_edges.clear();
+        t_path_vertices.clear();
+    }
+
+    void begin_fill()
+    {
+        ++fill;
+        l_stack.clear();
+        t_stack.clear();
+    }
+
+    /// Returns false if already visited in the current fill
+    bool visit_layout(const int _l_fi)
+    {
+        if (l_visited[_l_fi] == fill) {
+            return false;
+        }
+        l_visited[_l_fi] = fill;
+        return true;
+    }
+
+    bool visit_target(const int _t_fi, const int _piece)
+    {
+        if (t_visited[2 * _t_fi + _piece] == fill) {
+            return false;
+        }
+        t_visited[2 * _t_fi + _piece] = fill;
+        return true;
+    }
+};
+
+/// [Kraevoy2003] / [Kraevoy2004] blocking condition, evaluated without embedding the path.
+/// The path is treated as a virtual barrier: Each segment between two edge midpoints (or a vertex and an edge midpoint)
+/// splits its face into two pieces, segments along an edge block that edge.
+/// A flood fill over (face, piece) pairs then collects the layout vertices left and right of the path.
+/// Returns false in *_supported if the path splits a face more than once. Use is_blocking_embedded() then.
+bool is_blocking_virtual(const Embedding& _em, const pm::edge_handle& _l_e, const VirtualPath& _path, BlockingWorkspace& _ws, bool* _supported)
+{
+    LE_ASSERT(!_em.is_embedded(_l_e));
+    LE_ASSERT_GEQ(_path.size(), 2);
+    LE_ASSERT(is_real_vertex(_path.front()));
+    LE_ASSERT(is_real_vertex(_path.back()));
+
+    const pm::Mesh& l_m = _em.layout_mesh();
+    const pm::Mesh& t_m = _em.target_mesh();
+    *_supported = true;
+    _ws.begin_query(l_m, t_m);
+
+    // Sorted layout vertices in the layout patch left of _l_h_seed.
+    // _l_e is treated as embedded.
+    auto layout_side = [&](const pm::halfedge_handle& _l_h_seed) {
+        std::vector<int> result;
+        _ws.begin_fill();
+        auto& stack = _ws.l_stack;
+        stack.push_back(_l_h_seed.face());
+        _ws.visit_layout(_l_h_seed.face().idx.value);
+        while (!stack.empty()) {
+            const auto l_f = stack.back();
+            stack.pop_back();
+            for (const auto l_v : l_f.vertices()) {
+                result.push_back(l_v.idx.value);
+            }
+            for (const auto l_h_f : l_f.halfedges()) {
+                const auto l_h_opp = l_h_f.opposite();
+                if (l_h_opp.edge() == _l_e || _em.is_embedded(l_h_opp) || l_h_opp.is_boundary()) {
+                    continue;
+                }
+                if (_ws.visit_layout(l_h_opp.face().idx.value)) {
+                    stack.push_back(l_h_opp.face());
+                }
+            }
+        }
+        std::sort(result.begin(), result.end());
+        result.erase(std::unique(result.begin(), result.end()), result.end());
+        return result;
+    };
+
+    // Faces split by the path, see BlockingWorkspace
+    using FaceSplit = BlockingWorkspace::FaceSplit;
+    auto& t_splits = _ws.t_splits;
+    auto& t_crossed_edges = _ws.t_crossed_edges;
+    auto& t_path_edges = _ws.t_path_edges;
+    auto& t_path_vertices = _ws.t_path_vertices;
+
+    // The pieces left and right of the path
+    std::pair<int, int> seed_left = {-1, -1};
+    std::pair<int, int> seed_right = {-1, -1};
+
+    auto add_split = [&](const pm::halfedge_handle& _t_he_from_c, const int _piece_c, const int _piece_x, const int _piece_y, const int _piece_left) {
+        // _t_he_from_c starts at the corner c. The other corners x, y follow in ccw order.
+        const auto t_f = _t_he_from_c.face();
+        if (!t_f.is_valid() || t_splits.count(t_f.idx.value)) {
+            return false;
+        }
+        FaceSplit split;
+        int i = 0;
+        for (const auto t_h : t_f.halfedges()) {
+            split.corners[i] = t_h.vertex_from().idx.value;
+            if (t_h.vertex_from() == _t_he_from_c.vertex_from()) {
+                split.pieces[i] = _piece_c;
+            }
+            else if (t_h.vertex_from() == _t_he_from_c.vertex_to()) {
+                split.pieces[i] = _piece_x;
+            }
+            else {
+                split.pieces[i] = _piece_y;
+            }
+            ++i;
+        }
+        t_splits[t_f.idx.value] = split;
+        if (seed_left.first < 0) {
+            seed_left = {t_f.idx.value, _piece_left};
+            seed_right = {t_f.idx.value, 1 - _piece_left};
+        }
+        return true;
+    };
+
+    auto halfedge_in_face_from = [&](const pm::face_handle& _t_f, const pm::vertex_handle& _t_v) {
+        for (const auto t_h : _t_f.halfedges()) {
+            if (t_h.vertex_from() == _t_v) {
+                return t_h;
+            }
+        }
+        return pm::halfedge_handle::invalid;
+    };
+
+    for (int i = 0; i < (int)_path.size(); ++i) {
+        if (is_real_vertex(_path[i])) {
+            t_path_vertices.insert(real_vertex(_path[i]).value);
+        }
+        else {
+            t_crossed_edges.insert(real_edge(_path[i]).value);
+        }
+    }
+
+    for (int i = 0; i + 1 < (int)_path.size(); ++i) {
+        const auto& vv0 = _path[i];
+        const auto& vv1 = _path[i + 1];
+        bool ok = false;
+        if (is_real_vertex(vv0) && is_real_vertex(vv1)) {
+            // Along an edge
+            const auto t_he = pm::halfedge_from_to(real_vertex(vv0, t_m), real_vertex(vv1, t_m));
+            if (t_he.is_valid()) {
+                t_path_edges.insert(t_he.edge().idx.value);
+                ok = true;
+            }
+        }
+        else if (is_real_vertex(vv0) != is_real_vertex(vv1)) {
+            // From a vertex u to the midpoint of the opposite edge (or reverse).
+            // With corners (u, x, y) in ccw order, x is right and y is left of the direction u -> midpoint.
+            const bool forward = is_real_vertex(vv0);
+            const auto t_u = real_vertex(forward ? vv0 : vv1, t_m);
+            const auto t_e = real_edge(forward ? vv1 : vv0, t_m);
+            const auto t_f = triangle_with_edge_and_opposite_vertex(t_e, t_u);
+            if (t_f.is_valid()) {
+                ok = add_split(halfedge_in_face_from(t_f, t_u), -1, 0, 1, forward ? 1 : 0);
+            }
+        }
+        else {
+            // Between the midpoints of two edges (c, x) and (c, y) of a face.
+            // The corner c is on the left iff the path starts on (c, x), with corners (c, x, y) in ccw order.
+            const auto t_e0 = real_edge(vv0, t_m);
+            const auto t_e1 = real_edge(vv1, t_m);
+            const auto t_c = common_vertex(t_e0, t_e1);
+            const auto t_f = common_face(t_e0, t_e1);
+            if (t_c.is_valid() && t_f.is_valid()) {
+                const auto t_he_c = halfedge_in_face_from(t_f, t_c);
+                const bool starts_at_x = t_e0 == t_he_c.edge();
+                ok = add_split(t_he_c, 0, 1, 1, starts_at_x ? 0 : 1);
+            }
+        }
+        if (!ok) {
+            *_supported = false;
+            return false;
+        }
+    }
+
+    // Split faces whose pieces meet at a path vertex other than the splitting one are not supported
+    for (const auto& [t_fi, split] : t_splits) {
+        for (int i = 0; i < 3; ++i) {
+            if (split.pieces[i] >= 0 && t_path_vertices.count(split.corners[i])) {
+                *_supported = false;
+                return false;
+            }
+        }
+    }
+
+    // Path along edges only: seed with the faces incident to the first path edge
+    if (seed_left.first < 0) {
+        const auto t_he = pm::halfedge_from_to(real_vertex(_path[0], t_m), real_vertex(_path[1], t_m));
+        if (t_he.is_boundary() || t_he.opposite().is_boundary()) {
+            *_supported = false;
+            return false;
+        }
+        seed_left = {t_he.face().idx.value, 0};
+        seed_right = {t_he.opposite().face().idx.value, 0};
+    }
+
+    // Piece of _t_f containing the corner _t_vi (-1 if the corner is on the path)
+    auto corner_piece = [&](const int _t_fi, const int _t_vi) {
+        const auto it = t_splits.find(_t_fi);
+        if (it == t_splits.end()) {
+            return 0;
+        }
+        for (int i = 0; i < 3; ++i) {
+            if (it->second.corners[i] == _t_vi) {
+                return it->second.pieces[i];
+            }
+        }
+        LE_ERROR_THROW("Vertex not in face.");
+    };
+
+    // Piece of _t_f containing the whole (not crossed) edge between _t_vi_a and _t_vi_b
+    auto edge_piece = [&](const int _t_fi, const int _t_vi_a, const int _t_vi_b) {
+        const int p_a = corner_piece(_t_fi, _t_vi_a);
+        return (p_a >= 0) ? p_a : corner_piece(_t_fi, _t_vi_b);
+    };
+
+    const int t_l_v_start = _em.matching_layout_vertex(real_vertex(_path.front(), t_m)).idx.value;
+    const int t_l_v_end = _em.matching_layout_vertex(real_vertex(_path.back(), t_m)).idx.value;
+
+    // Flood fill the target patch containing _seed, until a layout vertex not in _l_side is found.
+    // The endpoints of the path are contained in both patches.
+    // Returns true iff the patch contains exactly the layout vertices in _l_side.
+    auto target_side_matches = [&](const std::pair<int, int>& _seed, const std::vector<int>& _l_side) {
+        std::vector<int> found = {t_l_v_start, t_l_v_end};
+        auto collect = [&](const int _l_vi) {
+            if (std::find(found.begin(), found.end(), _l_vi) == found.end()) {
+                if (!std::binary_search(_l_side.begin(), _l_side.end(), _l_vi)) {
+                    return false;
+                }
+                found.push_back(_l_vi);
+            }
+            return true;
+        };
+        if (!collect(t_l_v_start) || !collect(t_l_v_end)) {
+            return false;
+        }
+
+        _ws.begin_fill();
+        auto& stack = _ws.t_stack;
+        stack.push_back(_seed);
+        _ws.visit_target(_seed.first, _seed.second);
+        while (!stack.empty()) {
+            const auto [t_fi, piece] = stack.back();
+            stack.pop_back();
+            const auto t_f = t_m.faces()[t_fi];
+
+            for (const auto t_v : t_f.vertices()) {
+                const int p = corner_piece(t_fi, t_v.idx.value);
+                if (p == piece || p < 0) {
+                    const auto l_v = _em.matching_layout_vertex(t_v);
+                    if (l_v.is_valid() && !collect(l_v.idx.value)) {
+                        return false;
+                    }
+                }
+            }
+
+            auto push = [&](const int _t_fi, const int _piece) {
+                if (_ws.visit_target(_t_fi, _piece)) {
+                    stack.push_back({_t_fi, _piece});
+                }
+            };
+
+            for (const auto t_h : t_f.halfedges()) {
+                const auto t_h_opp = t_h.opposite();
+                const auto t_e = t_h.edge();
+                if (t_h_opp.is_boundary() || _em.is_blocked(t_e) || t_path_edges.count(t_e.idx.value)) {
+                    continue;
+                }
+                const int t_fi_opp = t_h_opp.face().idx.value;
+                const int t_vi_a = t_h.vertex_from().idx.value;
+                const int t_vi_b = t_h.vertex_to().idx.value;
+                if (t_crossed_edges.count(t_e.idx.value)) {
+                    // Each half of the edge connects the pieces containing its endpoint
+                    for (const int t_vi : {t_vi_a, t_vi_b}) {
+                        if (corner_piece(t_fi, t_vi) == piece) {
+                            push(t_fi_opp, corner_piece(t_fi_opp, t_vi));
+                        }
+                    }
+                }
+                else if (edge_piece(t_fi, t_vi_a, t_vi_b) == piece) {
+                    push(t_fi_opp, std::max(edge_piece(t_fi_opp, t_vi_a, t_vi_b), 0));
+                }
+            }
+        }
+        return found.size() == _l_side.size();
+    };
+
+    if (!target_side_matches(seed_left, layout_side(_l_e.halfedgeA()))) {
+        return true;
+    }
+    return !target_side_matches(seed_right, layout_side(_l_e.halfedgeB()));
+}
+
+/// [Kraevoy2003] / [Kraevoy2004] blocking condition.
+/// Check if sets of layout vertices left and right of path match between layout and target mesh.
+/// _l_e is not yet embedded. Falls back to a temporary embedding if the path cannot be evaluated virtually.
+bool is_blocking(Embedding& _em, const pm::edge_handle& _l_e, const VirtualPath& _path, BlockingWorkspace& _ws)
+{
+    bool supported = true;
+    const bool blocking = is_blocking_virtual(_em, _l_e, _path, _ws, &supported);
+    if (supported) {
+        return blocking;
+    }
+    return is_blocking_embedded(_em, _l_e, _path);
+}
+
+/// Shortest paths (along halfedgeA) for all _l_edges.
+/// Edges are grouped by a greedy vertex cover, so all paths at a layout vertex share one search (see Embedding::find_shortest_paths).
+std::vector<VirtualPath> find_shortest_paths(const Embedding& _em, const std::vector<pm::edge_handle>& _l_edges, const Embedding::ShortestPathMetric _metric)
+{
+    const pm::Mesh& l_m = _em.layout_mesh();
+    std::vector<VirtualPath> result(_l_edges.size());
+
+    std::vector<std::vector<int>> l_v_edges(l_m.all_vertices().size()); // Indices into _l_edges
+    for (int i = 0; i < (int)_l_edges.size(); ++i) {
+        l_v_edges[_l_edges[i].vertexA().idx.value].push_back(i);
+        l_v_edges[_l_edges[i].vertexB().idx.value].push_back(i);
+    }
+
+    std::vector<bool> covered(_l_edges.size(), false);
+    int num_covered = 0;
+    while (num_covered < (int)_l_edges.size()) {
+        // Layout vertex with the most uncovered edges
+        int best_l_vi = -1;
+        int best_count = 0;
+        for (int l_vi = 0; l_vi < (int)l_v_edges.size(); ++l_vi) {
+            const int count = std::count_if(l_v_edges[l_vi].begin(), l_v_edges[l_vi].end(), [&](int i) { return !covered[i]; });
+            if (count > best_count) {
+                best_l_vi = l_vi;
+                best_count = count;
+            }
+        }
+        LE_ASSERT_GEQ(best_l_vi, 0);
+
+        const auto l_v = l_m.vertices()[pm::vertex_index(best_l_vi)];
+        std::vector<int> edge_indices;
+        std::vector<pm::halfedge_handle> l_hes;
+        for (const int i : l_v_edges[best_l_vi]) {
+            if (!covered[i]) {
+                edge_indices.push_back(i);
+                l_hes.push_back(_l_edges[i].halfedgeA().vertex_from() == l_v ? _l_edges[i].halfedgeA() : _l_edges[i].halfedgeB());
+                covered[i] = true;
+                ++num_covered;
+            }
+        }
+
+        auto paths = _em.find_shortest_paths(l_hes, _metric);
+        for (int k = 0; k < (int)edge_indices.size(); ++k) {
+            if (l_hes[k] != _l_edges[edge_indices[k]].halfedgeA()) {
+                std::reverse(paths[k].begin(), paths[k].end());
+            }
+            result[edge_indices[k]] = std::move(paths[k]);
+        }
+    }
+
+    return result;
+}
+
+/// Candidate paths of embed_greedy, kept across rounds.
+/// Inserting a path only changes the target mesh in the faces it touches (the "zone"): elements there are split or blocked.
+/// A cached shortest path remains a shortest path if it doesn't touch the zone and every path through the zone is longer.
+/// The latter is checked via the Euclidean lower bound |s - z| + |z - t| over the bounding box of the zone.
+/// Only valid for the Geodesic metric.
+/// The cached paths are also kept in a heap ordered by (priority, cost, layout edge index), see top().
+/// Entries of dropped or replaced paths are discarded lazily.
+class CandidatePathCache
+{
+public:
+    struct Entry
+    {
+        int priority; // Lower is better
+        double cost;
+        int l_ei;
+        int version;
+
+        bool operator<(const Entry& _rhs) const
+        {
+            return std::tie(priority, cost, l_ei) < std::tie(_rhs.priority, _rhs.cost, _rhs.l_ei);
+        }
+    };
+
+    /// _priorities: Per layout edge, compared before the cost.
+    CandidatePathCache(const pm::Mesh& _l_m, std::vector<int>&& _priorities) :
+        paths(_l_m.all_edges().size()),
+        costs(_l_m.all_edges().size(), std::numeric_limits<double>::infinity()),
+        valid(_l_m.all_edges().size(), false),
+        swirls(_l_m.all_edges().size(), -1),
+        swirl_regions(_l_m.all_edges().size()),
+        priorities(std::move(_priorities)),
+        versions(_l_m.all_edges().size(), 0)
+    {
+        LE_ASSERT_EQ(priorities.size(), paths.size());
+    }
+
+    bool contains(const pm::edge_handle& _l_e) const
+    {
+        return valid[_l_e.idx.value];
+    }
+
+    const VirtualPath& path(const pm::edge_handle& _l_e) const
+    {
+        LE_ASSERT(contains(_l_e));
+        return paths[_l_e.idx.value];
+    }
+
+    double cost(const pm::edge_handle& _l_e) const
+    {
+        LE_ASSERT(contains(_l_e));
+        return costs[_l_e.idx.value];
+    }
+
+    void insert(const Embedding& _em, const pm::edge_handle& _l_e, VirtualPath&& _path)
+    {
+        const int l_ei = _l_e.idx.value;
+        costs[l_ei] = _em.path_length(_path);
+        paths[l_ei] = std::move(_path);
+        valid[l_ei] = true;
+        swirls[l_ei] = -1;
+        ++versions[l_ei];
+
+        // Drop outdated entries once they dominate the heap
+        if (heap.size() > 2 * paths.size()) {
+            heap.erase(std::remove_if(heap.begin(), heap.end(), [&](const Entry& _entry) { return !current(_entry); }), heap.end());
+            std::make_heap(heap.begin(), heap.end(), heap_cmp);
+        }
+        push({priorities[l_ei], costs[l_ei], l_ei, versions[l_ei]});
+    }
+
+    /// Entry of the cached path with the smallest (priority, cost, layout edge index), nullptr if there is none.
+    const Entry* top()
+    {
+        while (!heap.empty() && !current(heap.front())) {
+            std::pop_heap(heap.begin(), heap.end(), heap_cmp);
+            heap.pop_back();
+        }
+        return heap.empty() ? nullptr : &heap.front();
+    }
+
+    void pop()
+    {
+        LE_ASSERT(!heap.empty());
+        std::pop_heap(heap.begin(), heap.end(), heap_cmp);
+        heap.pop_back();
+    }
+
+    /// Re-inserts a popped entry. Ignored later if the path has been dropped or replaced in the meantime.
+    void push(const Entry& _entry)
+    {
+        heap.push_back(_entry);
+        std::push_heap(heap.begin(), heap.end(), heap_cmp);
+    }
+
+    /// Result of swirl_detection() for the cached path: 1 (swirl), 0 (no swirl), or -1 (unknown).
+    int swirl(const pm::edge_handle& _l_e) const
+    {
+        LE_ASSERT(contains(_l_e));
+        return swirls[_l_e.idx.value];
+    }
+
+    /// The result stays valid as long as no new path touches the region explored by the test.
+    void set_swirl(const pm::edge_handle& _l_e, const bool _swirl, const SwirlWorkspace& _ws)
+    {
+        LE_ASSERT(contains(_l_e));
+        swirls[_l_e.idx.value] = _swirl;
+        swirl_regions[_l_e.idx.value] = {_ws.explored_min, _ws.explored_max};
+    }
+
+    void clear()
+    {
+        std::fill(valid.begin(), valid.end(), false);
+        heap.clear();
+    }
+
+    /// Drops the cached paths that might change when _path is embedded for _l_e.
+    /// Has to be called before embedding, while the cached paths still refer to the current target mesh.
+    void invalidate(const Embedding& _em, const pm::edge_handle& _l_e, const VirtualPath& _path)
+    {
+        const pm::Mesh& t_m = _em.target_mesh();
+        valid[_l_e.idx.value] = false;
+
+        // Faces touched by the new path and their bounding box
+        std::vector<bool> zone(t_m.all_faces().size(), false);
+        const float inf = std::numeric_limits<float>::infinity();
+        tg::pos3 zone_min = {inf, inf, inf};
+        tg::pos3 zone_max = {-inf, -inf, -inf};
+        auto add_to_zone = [&](const pm::face_handle& _t_f) {
+            if (_t_f.is_invalid() || zone[_t_f.idx.value]) {
+                return;
+            }
+            zone[_t_f.idx.value] = true;
+            for (const auto t_v : _t_f.vertices()) {
+                const auto& p = _em.target_pos()[t_v];
+                zone_min = {std::min(zone_min.x, p.x), std::min(zone_min.y, p.y), std::min(zone_min.z, p.z)};
+                zone_max = {std::max(zone_max.x, p.x), std::max(zone_max.y, p.y), std::max(zone_max.z, p.z)};
+            }
+        };
+        for (const auto& vv : _path) {
+            if (is_real_vertex(vv)) {
+                for (const auto t_f : real_vertex(vv, t_m).faces()) {
+                    add_to_zone(t_f);
+                }
+            }
+            else {
+                const auto t_e = real_edge(vv, t_m);
+                add_to_zone(t_e.halfedgeA().face());
+                add_to_zone(t_e.halfedgeB().face());
+            }
+        }
+
+        auto touches_zone = [&](const VirtualVertex& _vv) {
+            if (is_real_vertex(_vv)) {
+                for (const auto t_f : real_vertex(_vv, t_m).faces()) {
+                    if (t_f.is_valid() && zone[t_f.idx.value]) {
+                        return true;
+                    }
+                }
+                return false;
+            }
+            const auto t_e = real_edge(_vv, t_m);
+            for (const auto& t_f : { t_e.halfedgeA().face(), t_e.halfedgeB().face() }) {
+                if (t_f.is_valid() && zone[t_f.idx.value]) {
+                    return true;
+                }
+            }
+            return false;
+        };
+
+        auto distance_to_zone = [&](const VirtualVertex& _vv) {
+            const tg::pos3 p = _em.element_pos(_vv);
+            const tg::pos3 q = {std::clamp(p.x, zone_min.x, zone_max.x), std::clamp(p.y, zone_min.y, zone_max.y), std::clamp(p.z, zone_min.z, zone_max.z)};
+            return tg::distance(p, q);
+        };
+
+        for (std::size_t l_ei = 0; l_ei < paths.size(); ++l_ei) {
+            if (!valid[l_ei]) {
+                continue;
+            }
+            const VirtualPath& cached_path = paths[l_ei];
+            if (cached_path.empty()
+                    || std::any_of(cached_path.begin(), cached_path.end(), touches_zone)
+                    || distance_to_zone(cached_path.front()) + distance_to_zone(cached_path.back()) <= costs[l_ei]) {
+                valid[l_ei] = false;
+            }
+            else if (swirls[l_ei] >= 0) {
+                const auto& [region_min, region_max] = swirl_regions[l_ei];
+                if (region_min.x <= zone_max.x && zone_min.x <= region_max.x
+                        && region_min.y <= zone_max.y && zone_min.y <= region_max.y
+                        && region_min.z <= zone_max.z && zone_min.z <= region_max.z) {
+                    swirls[l_ei] = -1;
+                }
+            }
+        }
+    }
+
+private:
+    std::vector<VirtualPath> paths; // Indexed by layout edge, along halfedgeA
+    std::vector<double> costs;
+    std::vector<bool> valid;
+    std::vector<int> swirls;
+    std::vector<std::pair<tg::pos3, tg::pos3>> swirl_regions; // Bounding box of the region explored by the swirl test
+
+    std::vector<int> priorities;
+    std::vector<int> versions; // Incremented whenever a path is inserted
+    std::vector<Entry> heap;
+
+    static bool heap_cmp(const Entry& _a, const Entry& _b)
+    {
+        return _b < _a; // Min-heap
+    }
+
+    bool current(const Entry& _entry) const
+    {
+        return valid[_entry.l_ei] && versions[_entry.l_ei] == _entry.version;
+    }
+};
+
 }
 
-GreedyResult embed_greedy(Embedding& _em, const GreedySettings& _settings, const std::string& _name)
+GreedyResult embed_greedy(Embedding& _em, const GreedySettings& _settings, const std::string& _name, const std::atomic<bool>* _cancel)
 {
     GreedyResult result(_name, _settings);
 
@@ -271,13 +972,11 @@ GreedyResult embed_greedy(Embedding& _em, const GreedySettings& _settings, const
         auto l_avg_neighbor_distance = l_m.vertices().make_attribute<double>();
         for (const auto l_v : l_m.vertices()) {
             double total_distance = 0.0;
-            int valence = 0;
-            for (const auto l_he : l_v.outgoing_halfedges()) {
-                const auto path = _em.find_shortest_path(l_he);
+            const auto l_hes = l_v.outgoing_halfedges().to_vector();
+            for (const auto& path : _em.find_shortest_paths(l_hes)) {
                 total_distance += _em.path_length(path);
-                ++valence;
             }
-            l_avg_neighbor_distance[l_v] = total_distance / valence;
+            l_avg_neighbor_distance[l_v] = total_distance / l_hes.size();
         }
 
         std::vector<pm::vertex_handle> extremal_vertices = l_m.vertices().to_vector();
@@ -313,73 +1012,189 @@ GreedyResult embed_greedy(Embedding& _em, const GreedySettings& _settings, const
 
     UnionFind l_v_components(l_m.vertices().size());
 
+    auto metric = Embedding::ShortestPathMetric::Geodesic;
+    if (_settings.use_vertex_repulsive_tracing) {
+        metric = Embedding::ShortestPathMetric::VertexRepulsive;
+    }
+
+    // Paths are only recomputed if the last insertion might have changed them.
+    // The VertexRepulsive metric is not additive, so there all paths are recomputed in each round.
+    const bool use_path_cache = (metric == Embedding::ShortestPathMetric::Geodesic);
+    std::vector<int> l_priorities(l_m.all_edges().size(), 1);
+    for (const auto l_e : l_m.edges()) {
+        l_priorities[l_e.idx.value] = 1 - incident_to_extremal_vertex(l_e);
+    }
+    CandidatePathCache path_cache(l_m, std::move(l_priorities));
+    SwirlWorkspace swirl_ws;
+    BlockingWorkspace blocking_ws;
+
+    // The best candidate is taken from the heap of cached paths, ordered by (priority, unpenalized cost, layout edge index).
+    // The blocking condition and the swirl test are only evaluated for contenders.
+    // This picks the same edge as scanning the candidates in l_m.edges() order, where ties go to the first (lowest index) edge,
+    // as long as the unpenalized cost is a lower bound of the penalized one.
+    // The scan skips the swirl test of edges that win by extremal priority alone, so it is kept for that combination.
+    const bool use_heap = (_settings.insertion_order != GreedySettings::InsertionOrder::Arbitrary)
+        && (_settings.swirl_penalty_factor >= 1.0)
+        && !(_settings.use_swirl_detection && _settings.prefer_extremal_vertices);
+
+    auto is_candidate = [&](const pm::edge_handle& _l_e, const bool _is_spanning_tree) {
+        if (l_is_embedded[_l_e]) {
+            return false;
+        }
+        if (!_settings.use_blocking_condition && !_is_spanning_tree) {
+            return !l_v_components.equivalent(_l_e.vertexA().idx.value, _l_e.vertexB().idx.value);
+        }
+        return true;
+    };
+
+    // Results for unchanged paths are reused from previous rounds.
+    auto is_swirl = [&](const pm::edge_handle& _l_e, const VirtualPath& _path) {
+        int swirl = path_cache.swirl(_l_e);
+        if (swirl < 0) {
+            swirl = swirl_detection(_em, _l_e.halfedgeA(), _path, swirl_ws);
+            path_cache.set_swirl(_l_e, swirl, swirl_ws);
+        }
+        return swirl != 0;
+    };
+
     while (l_num_embedded_edges < l_num_edges) {
+        if (_cancel && *_cancel) {
+            result.cancelled = true;
+            return result;
+        }
+
         VirtualPath best_path;
         double best_path_cost = std::numeric_limits<double>::infinity();
         pm::edge_handle best_l_e = pm::edge_handle::invalid;
 
         const bool is_spanning_tree = (l_num_embedded_edges >= l_num_vertices - 1);
 
+        // Candidate edges of this round
+        std::vector<pm::edge_handle> l_candidates;
         for (const auto l_e : l_m.edges()) {
-            if (l_is_embedded[l_e]) {
-                continue;
+            if (is_candidate(l_e, is_spanning_tree)) {
+                l_candidates.push_back(l_e);
+            }
+        }
+
+        // Unless we early-out after the first path, all candidate paths are needed.
+        // Compute the missing ones at once, so paths at the same layout vertex share one search.
+        if (_settings.insertion_order != GreedySettings::InsertionOrder::Arbitrary) {
+            std::vector<pm::edge_handle> l_missing;
+            for (const auto& l_e : l_candidates) {
+                if (!path_cache.contains(l_e)) {
+                    l_missing.push_back(l_e);
+                }
+            }
+            auto l_missing_paths = find_shortest_paths(_em, l_missing, metric);
+            for (int i = 0; i < (int)l_missing.size(); ++i) {
+                path_cache.insert(_em, l_missing[i], std::move(l_missing_paths[i]));
             }
+        }
 
-            int l_vi_a = l_e.vertexA().idx.value;
-            int l_vi_b = l_e.vertexB().idx.value;
+        if (use_heap) {
+            // Matches the initial (priority, cost) of the scan, which only accepts strictly better candidates
+            CandidatePathCache::Entry best_entry{1, std::numeric_limits<double>::infinity(), -1, 0};
+            std::vector<CandidatePathCache::Entry> popped;
+            while (const auto* top = path_cache.top()) {
+                if (!(*top < best_entry)) {
+                    break; // Neither this nor any later entry can win
+                }
+                const auto entry = *top;
+                path_cache.pop();
+                popped.push_back(entry);
 
-            if (!_settings.use_blocking_condition) {
-                if (!is_spanning_tree) {
-                    if (l_v_components.equivalent(l_vi_a, l_vi_b)) {
-                        continue;
+                const auto l_e = l_m.edges()[pm::edge_index(entry.l_ei)];
+                if (!is_candidate(l_e, is_spanning_tree)) {
+                    continue;
+                }
+                const VirtualPath& path = path_cache.path(l_e);
+
+                if (_settings.use_blocking_condition) {
+                    if (l_v_components.equivalent(l_e.vertexA().idx.value, l_e.vertexB().idx.value)) {
+                        if (is_blocking(_em, l_e, path, blocking_ws)) {
+                            continue;
+                        }
                     }
                 }
+
+                auto evaluated = entry;
+                if (_settings.use_swirl_detection && is_swirl(l_e, path)) {
+                    evaluated.cost *= _settings.swirl_penalty_factor;
+                }
+                if (evaluated < best_entry) {
+                    best_entry = evaluated;
+                }
             }
 
-            auto metric = Embedding::ShortestPathMetric::Geodesic;
-            if (_settings.use_vertex_repulsive_tracing) {
-                metric = Embedding::ShortestPathMetric::VertexRepulsive;
+            // Popped entries stay valid for the next round, unless invalidated by this insertion
+            for (const auto& entry : popped) {
+                path_cache.push(entry);
             }
 
-            VirtualPath path = _em.find_shortest_path(l_e.halfedgeA(), metric);
-            double path_cost = _em.path_length(path);
+            if (best_entry.l_ei >= 0) {
+                best_l_e = l_m.edges()[pm::edge_index(best_entry.l_ei)];
+                best_path = path_cache.path(best_l_e);
+                best_path_cost = best_entry.cost;
+            }
+        }
+        else {
+            for (const auto& l_e : l_candidates) {
+                int l_vi_a = l_e.vertexA().idx.value;
+                int l_vi_b = l_e.vertexB().idx.value;
 
-            // If we use the blocking condition, we have to discard the path if
-            // the vertices enclosed in new patches differ between the layout and the embedding.
-            if (_settings.use_blocking_condition) {
-                if (l_v_components.equivalent(l_vi_a, l_vi_b)) {
-                    if (is_blocking(_em, l_e, path)) {
-                        continue;
+                if (!path_cache.contains(l_e)) {
+                    path_cache.insert(_em, l_e, _em.find_shortest_path(l_e.halfedgeA(), metric));
+                }
+                VirtualPath path = path_cache.path(l_e);
+                double path_cost = path_cache.cost(l_e);
+
+                // If we use the blocking condition, we have to discard the path if
+                // the vertices enclosed in new patches differ between the layout and the embedding.
+                if (_settings.use_blocking_condition) {
+                    if (l_v_components.equivalent(l_vi_a, l_vi_b)) {
+                        if (is_blocking(_em, l_e, path, blocking_ws)) {
+                            continue;
+                        }
                     }
                 }
-            }
 
-            // If we use an arbitrary insertion order, we can early-out after the first path is found
-            if (_settings.insertion_order == GreedySettings::InsertionOrder::Arbitrary) {
-                best_path_cost = path_cost;
-                best_path = std::move(path);
-                best_l_e = l_e;
-                break;
-            }
+                // If we use an arbitrary insertion order, we can early-out after the first path is found
+                if (_settings.insertion_order == GreedySettings::InsertionOrder::Arbitrary) {
+                    best_path_cost = path_cost;
+                    best_path = std::move(path);
+                    best_l_e = l_e;
+                    break;
+                }
 
-            if (_settings.use_swirl_detection) {
-                // Only do the swirl test if the current path is already a contender.
-                if (path_cost < best_path_cost) {
-                    if (swirl_detection_bidirectional(_em, l_e.halfedgeA(), path)) {
-                        path_cost *= _settings.swirl_penalty_factor;
+                if (_settings.use_swirl_detection) {
+                    // Only do the swirl test if the current path is already a contender.
+                    // Results for unchanged paths are reused from previous rounds.
+                    if (path_cost < best_path_cost) {
+                        if (is_swirl(l_e, path)) {
+                            path_cost *= _settings.swirl_penalty_factor;
+                        }
                     }
                 }
-            }
 
-            const int extremal_priority = 1 - incident_to_extremal_vertex(l_e);
-            const int best_extremal_priority = 1 - incident_to_extremal_vertex(best_l_e);
-            if (std::tie(extremal_priority, path_cost) < std::tie(best_extremal_priority, best_path_cost)) {
-                best_path_cost = path_cost;
-                best_path = std::move(path);
-                best_l_e = l_e;
+                // Strict comparison: Ties go to the first candidate in l_m.edges() order, i.e. the lowest layout edge index.
+                const int extremal_priority = 1 - incident_to_extremal_vertex(l_e);
+                const int best_extremal_priority = 1 - incident_to_extremal_vertex(best_l_e);
+                if (std::tie(extremal_priority, path_cost) < std::tie(best_extremal_priority, best_path_cost)) {
+                    best_path_cost = path_cost;
+                    best_path = std::move(path);
+                    best_l_e = l_e;
+                }
             }
         }
 
+        if (use_path_cache) {
+            path_cache.invalidate(_em, best_l_e, best_path);
+        }
+        else {
+            path_cache.clear();
+        }
+
         result.insertion_sequence.push_back(best_l_e);
         _em.embed_path(best_l_e.halfedgeA(), best_path);
         l_v_components.merge(best_l_e.vertexA().idx.value, best_l_e.vertexB().idx.value);
@@ -438,34 +1253,106 @@ GreedyResult embed_schreiner(Embedding& _em, const GreedySettings& _settings)
     return embed_greedy(_em, settings, "schreiner");
 }
 
-std::vector<GreedyResult> embed_greedy(Embedding& _em, const std::vector<GreedySettings>& _all_settings)
+std::vector<GreedyResult> embed_greedy(Embedding& _em, const std::vector<GreedySettings>& _all_settings, const GreedyPortfolioSettings& _portfolio_settings)
 {
     const int n = _all_settings.size();
-    std::vector<Embedding> all_embeddings(n, _em); // n copies
     std::vector<GreedyResult> all_results(n);
+    if (n == 0) {
+        return all_results;
+    }
 
-    //#pragma omp parallel for
-    for (std::size_t i = 0; i < n; ++i) {
-        const auto& settings = _all_settings[i];
+    const int num_threads = std::min(n, (_portfolio_settings.num_threads > 0) ? _portfolio_settings.num_threads : omp_get_max_threads());
 
-        auto& em = all_embeddings[i];
+    // The vertex repulsive energy is computed lazily. Compute it once here, so the copies share the fields
+    // of the initial target mesh (see VertexRepulsiveEnergy) instead of each computing them again.
+    const bool any_vertex_repulsive = std::any_of(_all_settings.begin(), _all_settings.end(), [](const GreedySettings& _settings) {
+        return _settings.use_vertex_repulsive_tracing;
+    });
+    if (any_vertex_repulsive) {
+        const auto l_v = _em.layout_mesh().vertices().first();
+        _em.get_vertex_repulsive_energy(_em.matching_target_vertex(l_v), l_v);
+    }
+
+    // Attributes can't be registered on a mesh concurrently.
+    // Thus, each thread works on its own copy of the input (and layout mesh).
+    std::deque<EmbeddingInput> thread_inputs;
+    if (num_threads > 1) {
+        for (int i = 0; i < num_threads; ++i) {
+            thread_inputs.emplace_back(_em.embedding_input());
+        }
+    }
+
+    // Instead of keeping n copies around, each thread only keeps its best embedding so far
+    // and reuses the other copy for the next run.
+    std::vector<std::unique_ptr<Embedding>> thread_best_em(num_threads);
+    std::vector<double> thread_best_cost(num_threads, std::numeric_limits<double>::infinity());
+
+    std::atomic<bool> cancel{false};
+    std::mutex output_mutex;
+    std::exception_ptr exception;
+
+    #pragma omp parallel for schedule(dynamic, 1) num_threads(num_threads)
+    for (int i = 0; i < n; ++i) {
+        const int thread = omp_get_thread_num();
+        const auto& settings = _all_settings[i];
         auto& result = all_results[i];
 
-        em = _em; // copy
-        result = embed_greedy(em, settings);
+        try {
+            if (cancel) {
+                result = GreedyResult("greedy", settings);
+                result.cancelled = true;
+                continue;
+            }
 
-        if (result.settings.use_swirl_detection)
-            result.algorithm += "_swirl";
-        if (result.settings.use_vertex_repulsive_tracing)
-            result.algorithm += "_repulsive";
-        if (result.settings.prefer_extremal_vertices)
-            result.algorithm += "_extremal";
+            EmbeddingInput& input = (num_threads > 1) ? thread_inputs[thread] : _em.embedding_input();
+            auto em = std::make_unique<Embedding>(_em, input); // copy
+            result = embed_greedy(*em, settings, "greedy", &cancel);
+
+            if (result.settings.use_swirl_detection)
+                result.algorithm += "_swirl";
+            if (result.settings.use_vertex_repulsive_tracing)
+                result.algorithm += "_repulsive";
+            if (result.settings.prefer_extremal_vertices)
+                result.algorithm += "_extremal";
+
+            {
+                std::lock_guard<std::mutex> lock(output_mutex);
+                if (result.cancelled) {
+                    std::cout << "Embedding cancelled: " << result.algorithm << std::endl;
+                }
+                else {
+                    std::cout << "Embedding cost: " << result.cost << std::endl;
+                }
+            }
+
+            if (std::isfinite(_portfolio_settings.target_cost) && result.cost < _portfolio_settings.target_cost) {
+                cancel = true;
+            }
+
+            // Same criterion as best()
+            if (result.cost < thread_best_cost[thread]) {
+                thread_best_cost[thread] = result.cost;
+                thread_best_em[thread] = std::move(em);
+            }
+        }
+        catch (...) {
+            std::lock_guard<std::mutex> lock(output_mutex);
+            if (!exception) {
+                exception = std::current_exception();
+            }
+            cancel = true;
+        }
+    }
 
-        std::cout << "Embedding cost: " << result.cost << std::endl;
+    if (exception) {
+        std::rethrow_exception(exception);
     }
 
     int best_idx;
     const auto& best_result = best(all_results, best_idx);
+    const int best_thread = std::min_element(thread_best_cost.begin(), thread_best_cost.end()) - thread_best_cost.begin();
+    LE_ASSERT(thread_best_em[best_thread]);
+    LE_ASSERT_EQ(thread_best_cost[best_thread], best_result.cost);
 
     std::cout << "Best settings:" << std::endl;
     std::cout << std::boolalpha;
@@ -474,12 +1361,12 @@ std::vector<GreedyResult> embed_greedy(Embedding& _em, const std::vector<GreedyS
     std::cout << "    prefer_extremal_vertices: " << best_result.settings.prefer_extremal_vertices << std::endl;
     std::cout << "Best cost: " << best_result.cost << std::endl;
 
-    _em = all_embeddings[best_idx]; // copy
+    _em = Embedding(*thread_best_em[best_thread], _em.embedding_input()); // copy
 
     return all_results;
 }
 
-std::vector<GreedyResult> embed_competitors(Embedding& _em, const GreedySettings& _settings)
+std::vector<GreedyResult> embed_competitors(Embedding& _em, const GreedySettings& _settings, const GreedyPortfolioSettings& _portfolio_settings)
 {
     std::vector<GreedySettings> all_settings;
     { // Plain
@@ -515,7 +1402,7 @@ std::vector<GreedyResult> embed_competitors(Embedding& _em, const GreedySettings
         all_settings.push_back(settings);
     }
 
-    return embed_greedy(_em, all_settings);
+    return embed_greedy(_em, all_settings, _portfolio_settings);
 }
 
 const GreedyResult& best(const std::vector<GreedyResult>& _results)
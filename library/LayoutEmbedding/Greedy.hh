@@ -3,6 +3,8 @@
 #include <LayoutEmbedding/Embedding.hh>
 #include <LayoutEmbedding/InsertionSequence.hh>
 
+#include <atomic>
+
 namespace LayoutEmbedding {
 
 struct GreedySettings
@@ -40,17 +42,29 @@ struct GreedyResult
     GreedySettings settings;
     InsertionSequence insertion_sequence;
     double cost = std::numeric_limits<double>::infinity();
+    bool cancelled = false; // Stopped (or never started) before completion, see GreedyPortfolioSettings::target_cost
+};
+
+/// Settings for running multiple greedy variants
+struct GreedyPortfolioSettings
+{
+    // Number of variants that run concurrently. Set to <= 0 to use all available cores.
+    int num_threads = 1;
+
+    // Cancel the remaining variants once one of them reaches a cost below this. Set to infinity to disable.
+    double target_cost = std::numeric_limits<double>::infinity();
 };
 
 // Run a single greedy variant
-GreedyResult embed_greedy(Embedding& _em, const GreedySettings& _settings = GreedySettings(), const std::string& _name = "greedy");
+// If _cancel is set, it is checked once per insertion. A cancelled run leaves _em partially embedded.
+GreedyResult embed_greedy(Embedding& _em, const GreedySettings& _settings = GreedySettings(), const std::string& _name = "greedy", const std::atomic<bool>* _cancel = nullptr);
 GreedyResult embed_praun(Embedding& _em, const GreedySettings& _settings = GreedySettings());
 GreedyResult embed_kraevoy(Embedding& _em, const GreedySettings& _settings = GreedySettings());
 GreedyResult embed_schreiner(Embedding& _em, const GreedySettings& _settings = GreedySettings());
 
-// Run multiple greedy variants
-std::vector<GreedyResult> embed_greedy(Embedding& _em, const std::vector<GreedySettings>& _all_settings);
-std::vector<GreedyResult> embed_competitors(Embedding& _em, const GreedySettings& _settings = GreedySettings());
+// Run multiple greedy variants (in parallel). _em is set to the best result.
+std::vector<GreedyResult> embed_greedy(Embedding& _em, const std::vector<GreedySettings>& _all_settings, const GreedyPortfolioSettings& _portfolio_settings = GreedyPortfolioSettings());
+std::vector<GreedyResult> embed_competitors(Embedding& _em, const GreedySettings& _settings = GreedySettings(), const GreedyPortfolioSettings& _portfolio_settings = GreedyPortfolioSettings());
 
 const GreedyResult& best(const std::vector<GreedyResult>& _results);
 const GreedyResult& best(const std::vector<GreedyResult>& _results, int& best_idx);
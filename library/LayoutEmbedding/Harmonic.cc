@@ -1,7 +1,8 @@
 #include "Harmonic.hh"
 
 #include <LayoutEmbedding/Util/Assert.hh>
-#include <Eigen/SparseLU>
+
+#include <algorithm>
 
 namespace LayoutEmbedding
 {
@@ -37,104 +38,281 @@ double mean_value_weight(
     return w_ij;
 }
 
+double laplace_weight(
+        const pm::vertex_attribute<tg::pos3>& _pos,
+        const pm::halfedge_handle& _h,
+        const LaplaceWeights _weights)
+{
+    if (_weights == LaplaceWeights::Uniform)
+        return 1.0;
+    else if (_weights == LaplaceWeights::MeanValue)
+        return mean_value_weight(_pos, _h);
+    else
+        LE_ERROR_THROW("");
 }
 
-bool harmonic(
+}
+
+HarmonicSolver::HarmonicSolver(
         const pm::vertex_attribute<tg::pos3>& _pos,
         const pm::vertex_attribute<bool>& _constrained,
-        const Eigen::MatrixXd& _constraint_values,
-        Eigen::MatrixXd& _res,
         const LaplaceWeights _weights,
-        const bool _fallback_iterative)
+        const HarmonicSolverMethod _method,
+        const double _iterative_tolerance) :
+    weights(_weights),
+    method(_method),
+    symmetric(_weights == LaplaceWeights::Uniform),
+    n(_pos.mesh().vertices().size())
 {
     LE_ASSERT(_pos.mesh().is_compact());
 
-    const int n = _pos.mesh().vertices().size();
-    const int d = _constraint_values.cols();
+    int n_free = 0;
+    free_index.resize(n, -1);
+    for (auto v : _pos.mesh().vertices())
+    {
+        if (!_constrained[v])
+        {
+            LE_ASSERT(!v.is_boundary());
+            free_index[v.idx.value] = n_free++;
+        }
+    }
+
+    cg.setTolerance(_iterative_tolerance);
+    bicgstab.setTolerance(_iterative_tolerance);
+
+    assemble(_pos);
+    factorize();
+}
+
+bool HarmonicSolver::ok() const
+{
+    return factorized;
+}
+
+bool HarmonicSolver::is_iterative() const
+{
+    return method == HarmonicSolverMethod::Iterative;
+}
+
+template <typename ValuesT, typename ResultT>
+bool HarmonicSolver::solve_impl(
+        const ValuesT& _constraint_values,
+        ResultT& _res) const
+{
     LE_ASSERT_EQ(_constraint_values.rows(), n);
+    if (!factorized)
+        return false;
 
-    // Set up Laplace matrix and rhs
-    Eigen::MatrixXd rhs = Eigen::MatrixXd::Zero(n, d);
-    std::vector<Eigen::Triplet<double>> triplets;
-    for (auto v : _pos.mesh().vertices())
+    if (A.rows() == 0)
+    {
+        _res = _constraint_values;
+        return true;
+    }
+
+    const Eigen::MatrixXd rhs = B * _constraint_values;
+    Eigen::MatrixXd x;
+    if (method == HarmonicSolverMethod::Iterative)
     {
-        const int i = v.idx.value;
+        Eigen::MatrixXd guess = Eigen::MatrixXd::Zero(A.rows(), rhs.cols());
+        if (_res.rows() == n && _res.cols() == rhs.cols())
+        {
+            for (int i = 0; i < n; ++i)
+            {
+                if (free_index[i] >= 0)
+                    guess.row(free_index[i]) = _res.row(i);
+            }
+        }
+        else if (previous_solution.rows() == A.rows() && previous_solution.cols() == rhs.cols())
+        {
+            guess = previous_solution;
+        }
 
-        if (_constrained[v])
+        if (symmetric)
         {
-            triplets.push_back(Eigen::Triplet<double>(i, i, 1.0));
-            rhs.row(i) = _constraint_values.row(i);
+            x = cg.solveWithGuess(rhs, guess);
+            if (cg.info() != Eigen::Success)
+                return false;
         }
         else
         {
-            LE_ASSERT(!v.is_boundary());
+            x = bicgstab.solveWithGuess(rhs, guess);
+            if (bicgstab.info() != Eigen::Success)
+                return false;
+        }
+        previous_solution = x;
+    }
+    else if (symmetric)
+    {
+        x = ldlt.solve(rhs);
+        if (ldlt.info() != Eigen::Success)
+            return false;
+    }
+    else
+    {
+        x = lu.solve(rhs);
+        if (lu.info() != Eigen::Success)
+            return false;
+    }
 
-            for (auto h : v.outgoing_halfedges())
-            {
-                const int j = h.vertex_to().idx.value;
-                double w_ij;
-                if (_weights == LaplaceWeights::Uniform)
-                    w_ij = 1.0;
-                else if (_weights == LaplaceWeights::MeanValue)
-                    w_ij = mean_value_weight(_pos, h);
-                else
-                    LE_ERROR_THROW("");
-
-                triplets.push_back(Eigen::Triplet<double>(i, j, w_ij));
-                triplets.push_back(Eigen::Triplet<double>(i, i, -w_ij));
-            }
+    _res = _constraint_values;
+    for (int i = 0; i < n; ++i)
+    {
+        if (free_index[i] >= 0)
+            _res.row(i) = x.row(free_index[i]);
+    }
+
+    return true;
+}
+
+bool HarmonicSolver::solve(
+        const Eigen::MatrixXd& _constraint_values,
+        Eigen::MatrixXd& _res) const
+{
+    return solve_impl(_constraint_values, _res);
+}
+
+bool HarmonicSolver::solve(
+        const VertexParam& _constraint_values,
+        VertexParam& _res) const
+{
+    // tg::dpos2 is two consecutive doubles, so the attributes can be viewed as n x 2 row-major matrices
+    static_assert(sizeof(tg::dpos2) == 2 * sizeof(double));
+    using ParamMatrix = Eigen::Matrix<double, Eigen::Dynamic, 2, Eigen::RowMajor>;
+    const Eigen::Map<const ParamMatrix> constraint_values(reinterpret_cast<const double*>(_constraint_values.data()), n, 2);
+    Eigen::Map<ParamMatrix> res(reinterpret_cast<double*>(_res.data()), n, 2);
+    return solve_impl(constraint_values, res);
+}
+
+void HarmonicSolver::assemble(
+        const pm::vertex_attribute<tg::pos3>& _pos)
+{
+    // Row i of the Laplacian: sum_j w_ij (x_j - x_i) = 0.
+    // Negated and with the constrained x_j moved to the rhs: A x_free = B x.
+    const int n_free = std::count_if(free_index.begin(), free_index.end(), [] (int _i) { return _i >= 0; });
+    std::vector<Eigen::Triplet<double>> triplets_A;
+    std::vector<Eigen::Triplet<double>> triplets_B;
+    for (auto v : _pos.mesh().vertices())
+    {
+        const int i = free_index[v.idx.value];
+        if (i < 0)
+            continue;
+
+        for (auto h : v.outgoing_halfedges())
+        {
+            const double w_ij = laplace_weight(_pos, h, weights);
+            const int j = free_index[h.vertex_to().idx.value];
+            if (j >= 0)
+                triplets_A.push_back(Eigen::Triplet<double>(i, j, -w_ij));
+            else
+                triplets_B.push_back(Eigen::Triplet<double>(i, h.vertex_to().idx.value, w_ij));
+            triplets_A.push_back(Eigen::Triplet<double>(i, i, w_ij));
         }
     }
 
-    Eigen::SparseMatrix<double> L(n, n);
-    L.setFromTriplets(triplets.begin(), triplets.end());
+    A.resize(n_free, n_free);
+    A.setFromTriplets(triplets_A.begin(), triplets_A.end());
+    A.makeCompressed();
+    B.resize(n_free, n);
+    B.setFromTriplets(triplets_B.begin(), triplets_B.end());
+}
 
-    Eigen::SparseLU<Eigen::SparseMatrix<double>> solver;
-    solver.compute(L);
-    if (solver.info() == Eigen::Success)
+bool HarmonicSolver::factorize()
+{
+    factorized = false;
+    if (A.rows() == 0)
     {
-        _res = solver.solve(rhs);
-        if (solver.info() == Eigen::Success)
-            return true;
+        factorized = true;
+        return true;
+    }
+
+    if (method == HarmonicSolverMethod::Iterative)
+    {
+        // Only the preconditioner is computed here
+        if (symmetric)
+        {
+            cg.compute(A);
+            factorized = (cg.info() == Eigen::Success);
+        }
+        else
+        {
+            bicgstab.compute(A);
+            factorized = (bicgstab.info() == Eigen::Success);
+        }
+    }
+    else if (symmetric)
+    {
+        ldlt.compute(A);
+        factorized = (ldlt.info() == Eigen::Success);
+    }
+    else
+    {
+        lu.compute(A);
+        factorized = (lu.info() == Eigen::Success);
     }
 
-    std::cout << "LU solve failed" << std::endl;
+    return factorized;
+}
+
+namespace
+{
+
+/// Direct solve, optionally followed by an iterative one if it fails
+template <typename ValuesT, typename ResultT>
+bool solve_with_fallback(
+        const pm::vertex_attribute<tg::pos3>& _pos,
+        const pm::vertex_attribute<bool>& _constrained,
+        const ValuesT& _constraint_values,
+        ResultT& _res,
+        const LaplaceWeights _weights,
+        const bool _fallback_iterative)
+{
+    HarmonicSolver solver(_pos, _constrained, _weights);
+    if (solver.solve(_constraint_values, _res))
+        return true;
+
+    std::cout << "Direct solve failed" << std::endl;
 
     if (_fallback_iterative)
     {
         std::cout << "Falling back to iterative solver" << std::endl;
+
+        HarmonicSolver iterative_solver(_pos, _constrained, _weights, HarmonicSolverMethod::Iterative);
+        if (iterative_solver.solve(_constraint_values, _res))
+            return true;
+
+        std::cout << "Iterative solve failed" << std::endl;
     }
 
     return false;
 }
 
-bool harmonic_parametrization(
+}
+
+bool harmonic(
         const pm::vertex_attribute<tg::pos3>& _pos,
         const pm::vertex_attribute<bool>& _constrained,
-        const VertexParam& _constraint_values,
-        VertexParam& _res,
+        const Eigen::MatrixXd& _constraint_values,
+        Eigen::MatrixXd& _res,
         const LaplaceWeights _weights,
         const bool _fallback_iterative)
 {
     const int n = _pos.mesh().vertices().size();
-    const int d = 2;
-
-    // Convert constraints
-    Eigen::MatrixXd constraint_values = Eigen::MatrixXd::Zero(n, d);
-    for (auto v : _pos.mesh().vertices())
-        constraint_values.row(v.idx.value) = Eigen::Vector2d(_constraint_values[v].x, _constraint_values[v].y);
+    LE_ASSERT_EQ(_constraint_values.rows(), n);
 
-    // Compute
-    Eigen::MatrixXd res_mat;
-    if (!harmonic(_pos, _constrained, constraint_values, res_mat, _weights, _fallback_iterative))
-        return false;
+    return solve_with_fallback(_pos, _constrained, _constraint_values, _res, _weights, _fallback_iterative);
+}
 
-    // Convert result
+bool harmonic_parametrization(
+        const pm::vertex_attribute<tg::pos3>& _pos,
+        const pm::vertex_attribute<bool>& _constrained,
+        const VertexParam& _constraint_values,
+        VertexParam& _res,
+        const LaplaceWeights _weights,
+        const bool _fallback_iterative)
+{
+    // Solved in place, without converting to matrices
     _res = _pos.mesh().vertices().make_attribute<tg::dpos2>();
-    for (auto v : _pos.mesh().vertices())
-        _res[v] = tg::dpos2(res_mat(v.idx.value, 0), res_mat(v.idx.value, 1));
-
-    return true;
+    return solve_with_fallback(_pos, _constrained, _constraint_values, _res, _weights, _fallback_iterative);
 }
 
 }
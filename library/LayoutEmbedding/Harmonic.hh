@@ -1,10 +1,15 @@
 #pragma once
 
 #include <Eigen/Dense>
+#include <Eigen/IterativeLinearSolvers>
+#include <Eigen/SparseCholesky>
+#include <Eigen/SparseLU>
 #include <polymesh/pm.hh>
 #include <typed-geometry/tg.hh>
 #include <LayoutEmbedding/Parametrization.hh>
 
+#include <vector>
+
 namespace LayoutEmbedding
 {
 
@@ -14,6 +19,82 @@ enum class LaplaceWeights
     MeanValue,
 };
 
+enum class HarmonicSolverMethod
+{
+    Direct, // Sparse Cholesky (LDLT) or LU
+    Iterative, // Preconditioned CG (incomplete Cholesky) or BiCGSTAB (incomplete LU). Needs much less memory.
+};
+
+/// Harmonic fields on a fixed mesh with a fixed set of constrained vertices.
+/// The constrained vertices are eliminated, only the free vertices remain as unknowns.
+/// Uniform weights yield a symmetric system, which is factorized by sparse Cholesky (LDLT).
+/// Mean-value weights are not symmetric and use sparse LU instead.
+/// The factorization is computed once and reused for all constraint values passed to solve().
+/// With the iterative method, only the preconditioner is computed up front and each solve is warm-started.
+class HarmonicSolver
+{
+public:
+    HarmonicSolver(
+            const pm::vertex_attribute<tg::pos3>& _pos,
+            const pm::vertex_attribute<bool>& _constrained,
+            const LaplaceWeights _weights,
+            const HarmonicSolverMethod _method = HarmonicSolverMethod::Direct,
+            const double _iterative_tolerance = 1e-10);
+
+    // The iterative solvers refer to the system matrix
+    HarmonicSolver(const HarmonicSolver&) = delete;
+    HarmonicSolver& operator=(const HarmonicSolver&) = delete;
+
+    /// True if the last factorization succeeded.
+    bool ok() const;
+
+    /// True if constructed with HarmonicSolverMethod::Iterative.
+    bool is_iterative() const;
+
+    /// One row per vertex, one column per field. All fields share the factorization.
+    /// Only the rows of constrained vertices are read from _constraint_values.
+    /// Iterative method: If _res already has the size of the result, it is used as initial guess,
+    /// otherwise the previous solution (if it has the same number of columns). Not thread-safe.
+    /// The direct method can be called concurrently.
+    bool solve(
+            const Eigen::MatrixXd& _constraint_values,
+            Eigen::MatrixXd& _res) const;
+
+    /// Solves both coordinates of a parametrization directly on the attributes (no conversion to matrices).
+    /// _res has to be an attribute of the same mesh.
+    bool solve(
+            const VertexParam& _constraint_values,
+            VertexParam& _res) const;
+
+private:
+    template <typename ValuesT, typename ResultT>
+    bool solve_impl(
+            const ValuesT& _constraint_values,
+            ResultT& _res) const;
+
+    void assemble(
+            const pm::vertex_attribute<tg::pos3>& _pos);
+
+    bool factorize();
+
+    LaplaceWeights weights;
+    HarmonicSolverMethod method;
+    bool symmetric;
+    int n;
+
+    std::vector<int> free_index; // Per vertex: index among the free vertices, -1 if constrained
+    Eigen::SparseMatrix<double> A; // Free vertices x free vertices
+    Eigen::SparseMatrix<double> B; // Free vertices x all vertices, couples to the constrained vertices
+
+    Eigen::SimplicialLDLT<Eigen::SparseMatrix<double>> ldlt;
+    Eigen::SparseLU<Eigen::SparseMatrix<double>> lu;
+    Eigen::ConjugateGradient<Eigen::SparseMatrix<double>, Eigen::Lower | Eigen::Upper, Eigen::IncompleteCholesky<double>> cg;
+    Eigen::BiCGSTAB<Eigen::SparseMatrix<double>, Eigen::IncompleteLUT<double>> bicgstab;
+    bool factorized = false;
+
+    mutable Eigen::MatrixXd previous_solution; // Free vertices only
+};
+
 /// Compute harmonic field using mean-value weights.
 bool harmonic(
         const pm::vertex_attribute<tg::pos3>& _pos,
@@ -21,7 +102,7 @@ bool harmonic(
         const Eigen::MatrixXd& _constraint_values,
         Eigen::MatrixXd& _res,
         const LaplaceWeights _weights,
-        const bool _fallback_iterative = false);
+        const bool _fallback_iterative = false); // Retry with HarmonicSolverMethod::Iterative if the direct solve fails
 
 /// Compute harmonic field using mean-value weights.
 bool harmonic_parametrization(
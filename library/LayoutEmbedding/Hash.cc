@@ -4,8 +4,18 @@ namespace LayoutEmbedding {
 
 HashValue hash_combine(HashValue _a, HashValue _b)
 {
-    // Taken from https://stackoverflow.com/a/2595226/3077540
-    return _a ^ (_b + 0x9e3779b9 + (_a << 6) + (_a >> 2));
+    // Adapted from https://stackoverflow.com/a/2595226/3077540
+    // (64 bit golden ratio constant, _b is mixed first so that similar inputs don't cancel out)
+    return _a ^ (hash_mix(_b) + 0x9e3779b97f4a7c15ull + (_a << 6) + (_a >> 2));
+}
+
+HashValue hash_mix(HashValue _x)
+{
+    static_assert(sizeof(HashValue) == 8, "HashValue is expected to be 64 bit");
+    _x += 0x9e3779b97f4a7c15ull;
+    _x = (_x ^ (_x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    _x = (_x ^ (_x >> 27)) * 0x94d049bb133111ebull;
+    return _x ^ (_x >> 31);
 }
 
 }
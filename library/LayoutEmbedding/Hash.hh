@@ -10,6 +10,9 @@ using HashValue = std::size_t;
 
 HashValue hash_combine(HashValue _a, HashValue _b);
 
+/// Bijective 64 bit finalizer (splitmix64). Every input bit affects every output bit.
+HashValue hash_mix(HashValue _x);
+
 template<typename T>
 HashValue hash(const T& _x)
 {
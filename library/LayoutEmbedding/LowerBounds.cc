@@ -0,0 +1,84 @@
+#include "LowerBounds.hh"
+
+#include <LayoutEmbedding/EmbeddingState.hh>
+#include <LayoutEmbedding/Util/Assert.hh>
+
+namespace LayoutEmbedding {
+
+namespace {
+
+double conflict_reroute_lower_bound(EmbeddingState& _es)
+{
+    const double base = _es.cost_lower_bound();
+    if (std::isinf(base) || !_es.settings->use_proactive_pruning) {
+        return base;
+    }
+
+    // With proactive pruning, every completion of _es starts by inserting one of the conflicting edges X
+    // along its candidate path. The candidates conflicting with X then have to be rerouted around it.
+    // The resulting bound is the minimum over all X.
+    Embedding& em = _es.em;
+    const auto l_es_conflicting = _es.conflicting_edges();
+    if (l_es_conflicting.empty()) {
+        return base;
+    }
+
+    double result = std::numeric_limits<double>::infinity();
+    for (const auto& l_ei_X : l_es_conflicting) {
+        const auto l_he_X = em.layout_mesh().edges()[l_ei_X].halfedgeA();
+
+        const auto cp = em.checkpoint();
+        em.embed_path(l_he_X, _es.candidate_paths[l_ei_X]);
+
+        double bound_X = base;
+        for (const auto& l_ei_Y : _es.get_conflicting_candidates(l_ei_X)) {
+            const auto& old_path = _es.candidate_paths[l_ei_Y];
+            const auto new_path = em.find_shortest_path(em.layout_mesh().edges()[l_ei_Y].halfedgeA());
+            if (new_path.empty()) {
+                bound_X = std::numeric_limits<double>::infinity();
+                break;
+            }
+            // Signed: X splits edges, which can open shortcuts, so a rerouted path can also get shorter.
+            // The sum is then exactly the CandidatePaths bound of the child that inserts X.
+            // Partial sums are no lower bound for the full sum, so there is no early-out here.
+            bound_X += em.path_length(new_path) - em.path_length(old_path);
+        }
+
+        em.rollback(cp);
+
+        result = std::min(result, bound_X);
+        if (result <= base) {
+            break;
+        }
+    }
+
+    return std::max(base, result);
+}
+
+}
+
+const char* lower_bound_name(const BranchAndBoundSettings::LowerBound _type)
+{
+    switch (_type) {
+    case BranchAndBoundSettings::LowerBound::CandidatePaths:
+        return "CandidatePaths";
+    case BranchAndBoundSettings::LowerBound::ConflictReroute:
+        return "ConflictReroute";
+    }
+    LE_ASSERT(false);
+    return "";
+}
+
+double compute_lower_bound(EmbeddingState& _es, const BranchAndBoundSettings::LowerBound _type)
+{
+    switch (_type) {
+    case BranchAndBoundSettings::LowerBound::CandidatePaths:
+        return _es.cost_lower_bound();
+    case BranchAndBoundSettings::LowerBound::ConflictReroute:
+        return conflict_reroute_lower_bound(_es);
+    }
+    LE_ASSERT(false);
+    return 0.0;
+}
+
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <LayoutEmbedding/BranchAndBound.hh>
+
+namespace LayoutEmbedding {
+
+struct EmbeddingState;
+
+const char* lower_bound_name(const BranchAndBoundSettings::LowerBound _type);
+
+/// Lower bound on the cost of the best completion of _es within the branch-and-bound search space.
+/// _es may be modified temporarily but is restored before returning (its candidate paths and conflicts have to be up to date).
+double compute_lower_bound(
+        EmbeddingState& _es,
+        const BranchAndBoundSettings::LowerBound _type);
+
+}
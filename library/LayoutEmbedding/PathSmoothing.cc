@@ -88,6 +88,7 @@ Embedding subdivide(
         }
 
         em.target_mesh().compactify();
+        em.update_embedded_paths();
     }
 
     return em;
@@ -116,7 +117,10 @@ void preprocess_split_edges(
     }
 
     if (n_splits > 0)
+    {
         std::cout << "Split " << n_splits << " edges during path smoothing preprocess." << std::endl;
+        _em.update_embedded_paths();
+    }
 }
 
 void extract_flap_region(
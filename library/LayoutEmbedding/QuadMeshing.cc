@@ -6,6 +6,10 @@
 #include <LayoutEmbedding/Util/Assert.hh>
 #include <LayoutEmbedding/Visualization/Visualization.hh>
 
+#include <exception>
+#include <memory>
+#include <mutex>
+
 namespace LayoutEmbedding
 {
 
@@ -124,20 +128,32 @@ HalfedgeParam parametrize_patches(
     LE_ASSERT(_em.is_complete());
     auto param = _em.target_mesh().halfedges().make_attribute<tg::dpos2>();
 
+    struct Patch
+    {
+        pm::Mesh m;
+        pm::vertex_attribute<tg::pos3> pos;
+        pm::halfedge_attribute<pm::halfedge_handle> h_patch_to_target;
+        pm::vertex_attribute<bool> constrained;
+        VertexParam constraint_value;
+        VertexParam param;
+    };
+
+    // Extract patches and set up constraints.
+    // Sequential, since this registers attributes on the target mesh.
+    std::vector<std::unique_ptr<Patch>> patches;
     for (auto l_f : _em.layout_mesh().faces())
     {
         LE_ASSERT_EQ(l_f.vertices().size(), 4);
 
         // Extract patch mesh
-        pm::Mesh p_m;
-        pm::vertex_attribute<tg::pos3> p_pos;
+        patches.push_back(std::make_unique<Patch>());
+        Patch& p = *patches.back();
         pm::vertex_attribute<pm::vertex_handle> v_target_to_patch;
-        pm::halfedge_attribute<pm::halfedge_handle> h_patch_to_target;
-        extract_patch(_em, l_f, p_m, p_pos, v_target_to_patch, h_patch_to_target);
+        extract_patch(_em, l_f, p.m, p.pos, v_target_to_patch, p.h_patch_to_target);
 
         // Constrain patch boundary to rectangle
-        auto p_constrained = p_m.vertices().make_attribute<bool>(false);
-        auto p_constraint_value = p_m.vertices().make_attribute<tg::dpos2>();
+        p.constrained = p.m.vertices().make_attribute<bool>(false);
+        p.constraint_value = p.m.vertices().make_attribute<tg::dpos2>();
 
         const double width = _l_subdivisions[l_f.halfedges().first().edge()] + 1.0;
         const double height = _l_subdivisions[l_f.halfedges().last().edge()] + 1.0;
@@ -156,38 +172,59 @@ HalfedgeParam parametrize_patches(
                 length_acc += tg::length(_em.target_pos()[t_vi] - _em.target_pos()[t_vj]);
 
                 const auto p_vi = v_target_to_patch[t_vi];
-                p_constrained[p_vi] = true;
-                p_constraint_value[p_vi] = (1.0 - lambda_i) * corners[corner_idx] + lambda_i * corners[(corner_idx + 1) % 4];
+                p.constrained[p_vi] = true;
+                p.constraint_value[p_vi] = (1.0 - lambda_i) * corners[corner_idx] + lambda_i * corners[(corner_idx + 1) % 4];
             }
 
             ++corner_idx;
         }
+    }
 
-        // Compute Tutte embedding
-        // Try a few times with successively more uniform weights
-        VertexParam p_param;
-        if (!harmonic_parametrization(p_pos, p_constrained, p_constraint_value, p_param, LaplaceWeights::MeanValue, false))
+    // The patch systems are independent. Each thread only touches its own patch meshes
+    // and disjoint halfedges of the target mesh.
+    std::exception_ptr exception;
+    std::mutex exception_mutex;
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int i = 0; i < (int)patches.size(); ++i)
+    {
+        try
         {
-            if (!harmonic_parametrization(p_pos, p_constrained, p_constraint_value, p_param, LaplaceWeights::Uniform, true))
+            Patch& p = *patches[i];
+
+            // Compute Tutte embedding
+            // Try a few times with successively more uniform weights
+            if (!harmonic_parametrization(p.pos, p.constrained, p.constraint_value, p.param, LaplaceWeights::MeanValue, false))
+            {
+                if (!harmonic_parametrization(p.pos, p.constrained, p.constraint_value, p.param, LaplaceWeights::Uniform, true))
+                {
+                    LE_ERROR_THROW("Harmonic parametrization failed.");
+                }
+            }
+
+            for (auto v : p.m.vertices())
             {
-                LE_ERROR_THROW("Harmonic parametrization failed.");
+                LE_ASSERT(std::isfinite(p.param[v].x));
+                LE_ASSERT(std::isfinite(p.param[v].y));
             }
-        }
 
-        for (auto v : p_m.vertices())
-        {
-            LE_ASSERT(std::isfinite(p_param[v].x));
-            LE_ASSERT(std::isfinite(p_param[v].y));
+            // Transfer parametrization to target mesh
+            for (auto p_h : p.m.halfedges())
+            {
+                if (!p_h.is_boundary())
+                    param[p.h_patch_to_target[p_h]] = p.param[p_h.vertex_to()];
+            }
         }
-
-        // Transfer parametrization to target mesh
-        for (auto p_h : p_m.halfedges())
+        catch (...)
         {
-            if (!p_h.is_boundary())
-                param[h_patch_to_target[p_h]] = p_param[p_h.vertex_to()];
+            std::lock_guard<std::mutex> lock(exception_mutex);
+            if (!exception)
+                exception = std::current_exception();
         }
     }
 
+    if (exception)
+        std::rethrow_exception(exception);
+
     return param;
 }
 
@@ -0,0 +1,143 @@
+#include "ShortestPathLandmarks.hh"
+
+#include <LayoutEmbedding/ShortestPathWorkspace.hh>
+#include <LayoutEmbedding/Util/Assert.hh>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace LayoutEmbedding {
+
+namespace {
+
+// Distances from _source to all virtual vertices (vertex slots first, then edges), ignoring blocked elements.
+std::vector<double> virtual_vertex_distances(const pm::Mesh& _m, const pm::vertex_attribute<tg::pos3>& _pos, const pm::vertex_handle& _source)
+{
+    const int num_vertices = _m.all_vertices().size();
+    auto slot = [&](const VirtualVertex& _vv) {
+        return is_real_vertex(_vv) ? real_vertex(_vv).value : num_vertices + real_edge(_vv).value;
+    };
+    auto element_pos = [&](const VirtualVertex& _vv) {
+        if (is_real_vertex(_vv)) {
+            return _pos[real_vertex(_vv, _m)];
+        }
+        const auto e = real_edge(_vv, _m);
+        return tg::centroid(_pos[e.vertexA()], _pos[e.vertexB()]);
+    };
+
+    std::vector<double> result(num_vertices + _m.all_edges().size(), std::numeric_limits<double>::infinity());
+
+    ShortestPathWorkspace ws;
+    ws.reset(_m);
+    {
+        ShortestPathWorkspace::Candidate c;
+        c.vv = VirtualVertex(_source);
+        c.p = _pos[_source];
+        c.dist.distance_from_source = 0.0;
+        ws.push_heap(c);
+        result[slot(c.vv)] = 0.0;
+    }
+
+    while (!ws.heap.empty()) {
+        const auto u = ws.pop_heap();
+        if (u.dist.distance_from_source > result[slot(u.vv)]) {
+            continue; // Outdated
+        }
+        for_each_virtual_neighbor(_m, u.vv, [&](const VirtualVertex& _vv) {
+            const tg::pos3 p = element_pos(_vv);
+            const double d = u.dist.distance_from_source + tg::distance(u.p, p);
+            double& d_vv = result[slot(_vv)];
+            if (d < d_vv) {
+                d_vv = d;
+                ShortestPathWorkspace::Candidate c;
+                c.vv = _vv;
+                c.p = p;
+                c.dist.distance_from_source = d;
+                ws.push_heap(c);
+            }
+        });
+    }
+
+    return result;
+}
+
+}
+
+ShortestPathLandmarks::ShortestPathLandmarks(
+        const pm::Mesh& _m,
+        const pm::vertex_attribute<tg::pos3>& _pos,
+        const std::vector<pm::vertex_handle>& _candidates,
+        int _max_num_landmarks)
+{
+    LE_ASSERT_GEQ(_max_num_landmarks, 1);
+
+    num_vertices = _m.all_vertices().size();
+    num_edges = _m.all_edges().size();
+
+    // Farthest point sampling among the candidates: The next landmark is the candidate farthest away from all previous ones.
+    std::vector<std::vector<double>> distances_per_landmark;
+    std::vector<double> min_distance(_candidates.size(), std::numeric_limits<double>::infinity());
+    int next = _candidates.empty() ? -1 : 0;
+    while (next >= 0 && (int)landmarks.size() < _max_num_landmarks) {
+        const auto& v = _candidates[next];
+        landmarks.push_back(v.idx);
+        distances_per_landmark.push_back(virtual_vertex_distances(_m, _pos, v));
+
+        next = -1;
+        for (int i = 0; i < (int)_candidates.size(); ++i) {
+            min_distance[i] = std::min(min_distance[i], distances_per_landmark.back()[_candidates[i].idx.value]);
+            if (min_distance[i] > 0.0 && !std::isinf(min_distance[i]) && (next < 0 || min_distance[i] > min_distance[next])) {
+                next = i;
+            }
+        }
+    }
+
+    // Interleave, so a lookup touches a single cache line
+    const int n = landmarks.size();
+    const std::size_t num_slots = num_vertices + num_edges;
+    landmark_distances.resize(num_slots * n);
+    for (std::size_t s = 0; s < num_slots; ++s) {
+        for (int l = 0; l < n; ++l) {
+            landmark_distances[s * n + l] = distances_per_landmark[l][s];
+        }
+    }
+}
+
+int ShortestPathLandmarks::num_landmarks() const
+{
+    return landmarks.size();
+}
+
+double ShortestPathLandmarks::lower_bound(const VirtualVertex& _a, const VirtualVertex& _b) const
+{
+    const double* d_a = distances(_a);
+    const double* d_b = distances(_b);
+
+    double result = 0.0;
+    for (int l = 0; l < num_landmarks(); ++l) {
+        // Unreachable from this landmark (e.g. another component): no information
+        if (std::isinf(d_a[l]) || std::isinf(d_b[l])) {
+            continue;
+        }
+        result = std::max(result, std::abs(d_a[l] - d_b[l]));
+    }
+    return result;
+}
+
+const double* ShortestPathLandmarks::distances(const VirtualVertex& _vv) const
+{
+    int slot = -1;
+    if (is_real_vertex(_vv)) {
+        slot = real_vertex(_vv).value;
+        LE_ASSERT_L(slot, num_vertices);
+    }
+    else {
+        const int ei = real_edge(_vv).value;
+        LE_ASSERT_L(ei, num_edges);
+        slot = num_vertices + ei;
+    }
+    return landmark_distances.data() + (std::size_t)slot * num_landmarks();
+}
+
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <LayoutEmbedding/VirtualVertex.hh>
+
+#include <polymesh/pm.hh>
+#include <typed-geometry/tg.hh>
+
+#include <vector>
+
+namespace LayoutEmbedding {
+
+/// Precomputed distances for the ALT heuristic (A*, landmarks, triangle inequality) [Goldberg2005]:
+/// d(a, b) >= |d(L, a) - d(L, b)| for every landmark L.
+/// Distances are measured on the unblocked virtual vertex graph searched by Embedding::find_shortest_path.
+/// Blocking only removes steps, so the bound stays admissible and consistent for the blocked graph.
+/// Only valid for the mesh it was computed on: Refining the mesh creates shortcuts, so the bound would overestimate.
+class ShortestPathLandmarks
+{
+public:
+    /// At most _max_num_landmarks of the _candidates are used, chosen by farthest point sampling.
+    ShortestPathLandmarks(
+            const pm::Mesh& _m,
+            const pm::vertex_attribute<tg::pos3>& _pos,
+            const std::vector<pm::vertex_handle>& _candidates,
+            int _max_num_landmarks);
+
+    int num_landmarks() const;
+
+    /// Lower bound of the distance between _a and _b on the mesh passed to the constructor.
+    double lower_bound(const VirtualVertex& _a, const VirtualVertex& _b) const;
+
+private:
+    // Distances of _vv to all landmarks
+    const double* distances(const VirtualVertex& _vv) const;
+
+    int num_vertices = 0;
+    int num_edges = 0;
+
+    std::vector<pm::vertex_index> landmarks;
+    std::vector<double> landmark_distances; // Indexed by slot * num_landmarks() + landmark. Vertex slots first, then edges.
+};
+
+}
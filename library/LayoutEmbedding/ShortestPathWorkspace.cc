@@ -0,0 +1,83 @@
+#include "ShortestPathWorkspace.hh"
+
+#include <LayoutEmbedding/Util/Assert.hh>
+
+#include <algorithm>
+#include <functional>
+
+namespace LayoutEmbedding {
+
+void ShortestPathWorkspace::reset(const pm::Mesh& _m)
+{
+    num_vertices = _m.all_vertices().size();
+    const std::size_t num_slots = num_vertices + _m.all_edges().size();
+    if (stamps.size() < num_slots) {
+        stamps.resize(num_slots, 0);
+        distances.resize(num_slots);
+        prevs.resize(num_slots);
+    }
+
+    ++generation;
+    if (generation == 0) {
+        // Overflow. Invalidate all stamps explicitly.
+        std::fill(stamps.begin(), stamps.end(), 0);
+        generation = 1;
+    }
+
+    heap.clear();
+    num_settled = 0;
+}
+
+int ShortestPathWorkspace::slot(const VirtualVertex& _vv)
+{
+    const int s = is_real_vertex(_vv) ? real_vertex(_vv).value : num_vertices + real_edge(_vv).value;
+    LE_ASSERT_GEQ(s, 0);
+    LE_ASSERT_L(s, (int)stamps.size());
+    if (stamps[s] != generation) {
+        stamps[s] = generation;
+        distances[s] = Distance();
+        prevs[s] = VirtualVertex();
+    }
+    return s;
+}
+
+ShortestPathWorkspace::Distance& ShortestPathWorkspace::distance(const VirtualVertex& _vv)
+{
+    return distances[slot(_vv)];
+}
+
+VirtualVertex& ShortestPathWorkspace::prev(const VirtualVertex& _vv)
+{
+    return prevs[slot(_vv)];
+}
+
+void ShortestPathWorkspace::push_heap(const Candidate& _c)
+{
+    heap.push_back(_c);
+    std::push_heap(heap.begin(), heap.end(), std::greater<Candidate>());
+}
+
+ShortestPathWorkspace::Candidate ShortestPathWorkspace::pop_heap()
+{
+    std::pop_heap(heap.begin(), heap.end(), std::greater<Candidate>());
+    const Candidate c = heap.back();
+    heap.pop_back();
+    ++num_settled;
+    return c;
+}
+
+ShortestPathWorkspace& ShortestPathWorkspace::reverse()
+{
+    if (!reverse_workspace) {
+        reverse_workspace = std::make_unique<ShortestPathWorkspace>();
+    }
+    return *reverse_workspace;
+}
+
+ShortestPathWorkspace& ShortestPathWorkspace::thread_local_instance()
+{
+    static thread_local ShortestPathWorkspace workspace;
+    return workspace;
+}
+
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <LayoutEmbedding/Connectivity.hh>
+#include <LayoutEmbedding/VirtualVertex.hh>
+
+#include <typed-geometry/tg.hh>
+
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+
+namespace LayoutEmbedding {
+
+/// Reusable scratch memory for Embedding::find_shortest_path.
+/// Per-element data is generation-stamped, so starting a new search costs O(1)
+/// instead of O(|V| + |E|), and the heap storage is kept between searches.
+/// Not thread-safe. Use one workspace per thread (e.g. thread_local_instance()).
+struct ShortestPathWorkspace
+{
+    struct Distance
+    {
+        int edges_crossed = std::numeric_limits<int>::max();
+        double distance_from_source = std::numeric_limits<double>::infinity();
+        double remaining_distance_heuristic = 0.0; // Used for A* search
+
+        bool operator<(const Distance& rhs) const
+        {
+            return distance_from_source + remaining_distance_heuristic < rhs.distance_from_source + rhs.remaining_distance_heuristic;
+        }
+    };
+
+    struct Candidate
+    {
+        VirtualVertex vv;
+        tg::pos3 p;
+        Distance dist;
+
+        bool operator>(const Candidate& rhs) const
+        {
+            return rhs.dist < dist; // reversed
+        }
+    };
+
+    /// Starts a new search on _m. Invalidates all per-element data and clears the heap.
+    void reset(const pm::Mesh& _m);
+
+    /// Per-element data. Elements that were not touched in the current search have default values.
+    Distance& distance(const VirtualVertex& _vv);
+    VirtualVertex& prev(const VirtualVertex& _vv);
+
+    /// Min-heap storage (use with push_heap() / pop_heap()).
+    std::vector<Candidate> heap;
+    void push_heap(const Candidate& _c);
+    Candidate pop_heap();
+
+    /// Number of candidates popped from the heap since the last reset().
+    int num_settled = 0;
+
+    /// Second workspace for the backward direction of a bidirectional search. Allocated on first use.
+    ShortestPathWorkspace& reverse();
+
+    /// Workspace owned by the calling thread.
+    static ShortestPathWorkspace& thread_local_instance();
+
+private:
+    int slot(const VirtualVertex& _vv);
+
+    int num_vertices = 0;
+    uint32_t generation = 0;
+    std::vector<uint32_t> stamps;
+    std::vector<Distance> distances;
+    std::vector<VirtualVertex> prevs;
+
+    std::unique_ptr<ShortestPathWorkspace> reverse_workspace;
+};
+
+/// Calls _f for each virtual vertex adjacent to _vv in the graph searched by Embedding::find_shortest_path:
+/// A vertex is adjacent to its neighboring vertices and to the opposite edges of its incident triangles.
+/// An edge (midpoint) is adjacent to the opposite vertices and the other edges of its incident triangles.
+/// Blocking is not taken into account.
+template <typename F>
+void for_each_virtual_neighbor(const pm::Mesh& _m, const VirtualVertex& _vv, F&& _f)
+{
+    if (is_real_vertex(_vv)) {
+        const auto t_v = real_vertex(_vv, _m);
+        for (const auto t_v_adj : t_v.adjacent_vertices()) {
+            _f(VirtualVertex(t_v_adj));
+        }
+        for (const auto t_he_out : t_v.outgoing_halfedges()) {
+            if (!t_he_out.is_boundary()) {
+                _f(VirtualVertex(t_he_out.next().edge()));
+            }
+        }
+    }
+    else {
+        const auto t_e = real_edge(_vv, _m);
+        const auto t_he = t_e.halfedgeA();
+        const auto t_he_opp = t_e.halfedgeB();
+        if (!t_he.is_boundary()) {
+            _f(VirtualVertex(opposite_vertex(t_he)));
+        }
+        if (!t_he_opp.is_boundary()) {
+            _f(VirtualVertex(opposite_vertex(t_he_opp)));
+        }
+        if (!t_he.is_boundary()) {
+            _f(VirtualVertex(t_he.next().edge()));
+            _f(VirtualVertex(t_he.prev().edge()));
+        }
+        if (!t_he_opp.is_boundary()) {
+            _f(VirtualVertex(t_he_opp.prev().edge()));
+            _f(VirtualVertex(t_he_opp.next().edge()));
+        }
+    }
+}
+
+}
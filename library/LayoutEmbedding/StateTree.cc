@@ -0,0 +1,437 @@
+#include "StateTree.hh"
+
+#include <LayoutEmbedding/Util/Assert.hh>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+namespace LayoutEmbedding {
+
+namespace {
+
+void append_path(const VirtualPath& _path, std::vector<uint32_t>& _out)
+{
+    for (const auto& vv : _path) {
+        _out.push_back(vv.packed());
+    }
+}
+
+VirtualPath unpack_path(const uint32_t* _begin, const uint32_t* _end)
+{
+    VirtualPath path;
+    path.reserve(_end - _begin);
+    for (auto it = _begin; it != _end; ++it) {
+        path.push_back(VirtualVertex::from_packed(*it));
+    }
+    return path;
+}
+
+// Index of the pair (_a, _b), _a < _b, in a triangular bitset over _n labels.
+std::size_t pair_index(const int _a, const int _b, const int _n)
+{
+    LE_ASSERT_L(_a, _b);
+    return (std::size_t)_a * _n - (std::size_t)_a * (_a + 1) / 2 + (_b - _a - 1);
+}
+
+enum ConflictEncoding : uint32_t
+{
+    Pairs = 0,
+    Bitset = 1,
+};
+
+}
+
+StateTree::EncodedCandidates StateTree::encode(
+        const std::vector<VirtualPath>& _candidate_paths,
+        const std::vector<VirtualPath>& _parent_candidate_paths,
+        const CandidateConflicts& _candidate_conflicts)
+{
+    const int n = _candidate_paths.size();
+    const bool is_root = _parent_candidate_paths.empty();
+    LE_ASSERT(is_root || (int)_parent_candidate_paths.size() == n);
+
+    EncodedCandidates result;
+
+    // Candidate paths that differ from the parent
+    result.push_back(0); // Number of deltas
+    for (int i = 0; i < n; ++i) {
+        if (is_root || _candidate_paths[i] != _parent_candidate_paths[i]) {
+            result.push_back(i);
+            result.push_back(_candidate_paths[i].size());
+            append_path(_candidate_paths[i], result);
+            ++result[0];
+        }
+    }
+
+    // Candidate conflicts
+    const std::size_t num_pairs = _candidate_conflicts.num_conflicts();
+    const std::size_t num_bitset_words = ((std::size_t)n * (n - 1) / 2 + 31) / 32;
+    if (num_bitset_words < 2 * num_pairs) {
+        result.push_back(ConflictEncoding::Bitset);
+        result.push_back(num_bitset_words);
+        const std::size_t offset = result.size();
+        result.resize(offset + num_bitset_words, 0);
+        _candidate_conflicts.for_each_conflict([&](const pm::edge_index& _l_ei_A, const pm::edge_index& _l_ei_B) {
+            const std::size_t bit = pair_index(_l_ei_A.value, _l_ei_B.value, n);
+            result[offset + bit / 32] |= 1u << (bit % 32);
+        });
+    }
+    else {
+        result.push_back(ConflictEncoding::Pairs);
+        result.push_back(2 * num_pairs);
+        _candidate_conflicts.for_each_conflict([&](const pm::edge_index& _l_ei_A, const pm::edge_index& _l_ei_B) {
+            result.push_back(_l_ei_A.value);
+            result.push_back(_l_ei_B.value);
+        });
+    }
+
+    result.shrink_to_fit();
+    return result;
+}
+
+StateTree::StateTree(int _num_layout_edges, double _memory_budget) :
+    num_layout_edges(_num_layout_edges),
+    memory_budget(_memory_budget)
+{
+}
+
+StateTree::~StateTree()
+{
+    if (spill_file.is_open()) {
+        spill_file.close();
+        std::error_code ec;
+        std::filesystem::remove(spill_path, ec);
+    }
+}
+
+void StateTree::insert_root(const std::vector<VirtualPath>& _candidate_paths, const CandidateConflicts& _candidate_conflicts)
+{
+    LE_ASSERT(!contains(0));
+    LE_ASSERT_EQ(_candidate_paths.size(), num_layout_edges);
+
+    Node& root = nodes[0];
+    root.parent = 0;
+    root.candidates = encode(_candidate_paths, {}, _candidate_conflicts);
+    root.lru_it = lru.insert(lru.end(), 0);
+    memory_in_use += node_memory(root);
+    candidate_memory_in_use += candidate_memory(root);
+}
+
+void StateTree::insert(const HashValue _hash, const HashValue _parent, const pm::edge_index& _l_e, const VirtualPath& _path, EncodedCandidates&& _candidates, const HashValue _verification_hash)
+{
+    LE_ASSERT_NEQ(_hash, 0);
+    LE_ASSERT(!contains(_hash));
+    LE_ASSERT(contains(_parent));
+
+    Node& parent_node = node(_parent);
+    memory_in_use -= node_memory(parent_node);
+    parent_node.children.push_back(_hash);
+    memory_in_use += node_memory(parent_node);
+
+    Node& n = nodes[_hash];
+    n.parent = _parent;
+    n.verification_hash = _verification_hash;
+    n.l_e = _l_e.value;
+    append_path(_path, n.path);
+    n.candidates = std::move(_candidates);
+    n.lru_it = lru.insert(lru.end(), _hash);
+    memory_in_use += node_memory(n);
+    candidate_memory_in_use += candidate_memory(n);
+
+    enforce_memory_budget();
+}
+
+void StateTree::remove(const HashValue _hash)
+{
+    LE_ASSERT_NEQ(_hash, 0);
+    Node& n = node(_hash);
+    LE_ASSERT(n.children.empty());
+
+    Node& parent_node = node(n.parent);
+    auto& siblings = parent_node.children;
+    siblings.erase(std::find(siblings.begin(), siblings.end(), _hash));
+
+    if (n.spill_offset < 0) {
+        lru.erase(n.lru_it);
+    }
+    else {
+        free_spill_extent(n.spill_offset, n.spill_size * sizeof(uint32_t));
+    }
+    memory_in_use -= node_memory(n);
+    candidate_memory_in_use -= candidate_memory(n);
+    nodes.erase(_hash);
+}
+
+bool StateTree::contains(const HashValue _hash) const
+{
+    return nodes.count(_hash) > 0;
+}
+
+std::size_t StateTree::size() const
+{
+    return nodes.size();
+}
+
+HashValue StateTree::parent(const HashValue _hash) const
+{
+    return node(_hash).parent;
+}
+
+const std::vector<HashValue>& StateTree::children(const HashValue _hash) const
+{
+    return node(_hash).children;
+}
+
+pm::edge_index StateTree::inserted_edge(const HashValue _hash) const
+{
+    LE_ASSERT_NEQ(_hash, 0);
+    return pm::edge_index((int)node(_hash).l_e);
+}
+
+VirtualPath StateTree::inserted_path(const HashValue _hash) const
+{
+    LE_ASSERT_NEQ(_hash, 0);
+    const auto& path = node(_hash).path;
+    return unpack_path(path.data(), path.data() + path.size());
+}
+
+HashValue StateTree::verification_hash(const HashValue _hash) const
+{
+    return node(_hash).verification_hash;
+}
+
+std::vector<VirtualPath> StateTree::candidate_paths(const HashValue _hash)
+{
+    std::vector<VirtualPath> result(num_layout_edges);
+    std::vector<bool> resolved(num_layout_edges, false);
+    int num_resolved = 0;
+
+    // Walk towards the root. The first delta found for each edge is the most recent one.
+    EncodedCandidates buffer;
+    HashValue current = _hash;
+    while (num_resolved < num_layout_edges) {
+        const auto& data = load(current, buffer);
+        const uint32_t num_deltas = data[0];
+        std::size_t pos = 1;
+        for (uint32_t i = 0; i < num_deltas; ++i) {
+            const uint32_t l_ei = data[pos];
+            const uint32_t len = data[pos + 1];
+            pos += 2;
+            if (!resolved[l_ei]) {
+                result[l_ei] = unpack_path(data.data() + pos, data.data() + pos + len);
+                resolved[l_ei] = true;
+                ++num_resolved;
+            }
+            pos += len;
+        }
+
+        if (current == 0) {
+            break;
+        }
+        current = node(current).parent;
+    }
+    LE_ASSERT_EQ(num_resolved, num_layout_edges);
+
+    return result;
+}
+
+StateTree::CandidateConflicts StateTree::candidate_conflicts(const HashValue _hash)
+{
+    EncodedCandidates buffer;
+    const auto& data = load(_hash, buffer);
+
+    // Skip candidate paths
+    const uint32_t num_deltas = data[0];
+    std::size_t pos = 1;
+    for (uint32_t i = 0; i < num_deltas; ++i) {
+        pos += 2 + data[pos + 1];
+    }
+
+    const uint32_t encoding = data[pos];
+    const uint32_t num_words = data[pos + 1];
+    pos += 2;
+
+    CandidateConflicts result(num_layout_edges);
+    if (encoding == ConflictEncoding::Bitset) {
+        // Only visit the set bits. Their pairs (a, b) are visited in pair_index() order, so the row a only moves forward.
+        const int n = num_layout_edges;
+        int a = 0;
+        std::size_t row_begin = 0; // pair_index(a, a + 1, n)
+        for (uint32_t w = 0; w < num_words; ++w) {
+            uint32_t word = data[pos + w];
+            while (word != 0) {
+                const std::size_t bit = (std::size_t)w * 32 + __builtin_ctz(word);
+                word &= word - 1;
+                while (bit >= row_begin + (n - a - 1)) {
+                    row_begin += n - a - 1;
+                    ++a;
+                }
+                const int b = a + 1 + (int)(bit - row_begin);
+                result.insert(pm::edge_index(a), pm::edge_index(b));
+            }
+        }
+    }
+    else {
+        LE_ASSERT_EQ(encoding, ConflictEncoding::Pairs);
+        for (uint32_t i = 0; i < num_words; i += 2) {
+            result.insert(pm::edge_index((int)data[pos + i]), pm::edge_index((int)data[pos + i + 1]));
+        }
+    }
+    return result;
+}
+
+double StateTree::memory_estimate() const
+{
+    return memory_in_use + nodes.size() * (sizeof(HashValue) + sizeof(Node));
+}
+
+double StateTree::spilled_bytes() const
+{
+    return spill_file_size - spill_free_bytes;
+}
+
+StateTree::Node& StateTree::node(const HashValue _hash)
+{
+    LE_ASSERT(contains(_hash));
+    return nodes.at(_hash);
+}
+
+const StateTree::Node& StateTree::node(const HashValue _hash) const
+{
+    LE_ASSERT(contains(_hash));
+    return nodes.at(_hash);
+}
+
+const StateTree::EncodedCandidates& StateTree::load(const HashValue _hash, EncodedCandidates& _buffer)
+{
+    Node& n = node(_hash);
+    if (n.spill_offset < 0) {
+        touch(n);
+        return n.candidates;
+    }
+
+    // Read back from the spill file. The data stays on disk.
+    _buffer.resize(n.spill_size);
+    spill_file.seekg(n.spill_offset);
+    spill_file.read(reinterpret_cast<char*>(_buffer.data()), n.spill_size * sizeof(uint32_t));
+    LE_ASSERT(spill_file.good());
+    return _buffer;
+}
+
+void StateTree::touch(Node& _node)
+{
+    lru.splice(lru.end(), lru, _node.lru_it);
+}
+
+void StateTree::enforce_memory_budget()
+{
+    if (memory_budget <= 0.0 || candidate_memory_in_use <= memory_budget) {
+        return;
+    }
+
+    if (!spill_file.is_open()) {
+        const auto stamp = std::chrono::steady_clock::now().time_since_epoch().count();
+        spill_path = std::filesystem::temp_directory_path() / ("layout_embedding_state_tree_" + std::to_string(stamp) + ".bin");
+        spill_file.open(spill_path, std::ios::in | std::ios::out | std::ios::trunc | std::ios::binary);
+        LE_ASSERT(spill_file.is_open());
+        std::cout << "State tree exceeds memory budget. Spilling to " << spill_path << std::endl;
+    }
+
+    while (candidate_memory_in_use > memory_budget && !lru.empty()) {
+        const HashValue hash = lru.front();
+        lru.pop_front();
+
+        Node& n = node(hash);
+        memory_in_use -= node_memory(n);
+        candidate_memory_in_use -= candidate_memory(n);
+
+        n.spill_size = n.candidates.size();
+        n.spill_offset = allocate_spill_extent(n.spill_size * sizeof(uint32_t));
+        spill_file.seekp(n.spill_offset);
+        spill_file.write(reinterpret_cast<const char*>(n.candidates.data()), n.spill_size * sizeof(uint32_t));
+        LE_ASSERT(spill_file.good());
+
+        n.candidates = EncodedCandidates();
+        memory_in_use += node_memory(n);
+    }
+}
+
+int64_t StateTree::allocate_spill_extent(const int64_t _bytes)
+{
+    const auto it = spill_free_extents_by_size.lower_bound({_bytes, 0});
+    if (it == spill_free_extents_by_size.end()) {
+        // Append
+        const int64_t offset = spill_file_size;
+        spill_file_size += _bytes;
+        return offset;
+    }
+
+    const auto [size, offset] = *it;
+    spill_free_extents_by_size.erase(it);
+    spill_free_extents.erase(offset);
+    spill_free_bytes -= size;
+    if (size > _bytes) {
+        // Keep the remainder
+        spill_free_extents[offset + _bytes] = size - _bytes;
+        spill_free_extents_by_size.insert({size - _bytes, offset + _bytes});
+        spill_free_bytes += size - _bytes;
+    }
+    return offset;
+}
+
+void StateTree::free_spill_extent(const int64_t _offset, const int64_t _bytes)
+{
+    if (_bytes == 0) {
+        return;
+    }
+
+    int64_t offset = _offset;
+    int64_t size = _bytes;
+
+    // Merge with the following extent
+    auto next = spill_free_extents.find(offset + size);
+    if (next != spill_free_extents.end()) {
+        size += next->second;
+        spill_free_extents_by_size.erase({next->second, next->first});
+        spill_free_bytes -= next->second;
+        spill_free_extents.erase(next);
+    }
+
+    // Merge with the preceding extent
+    auto prev = spill_free_extents.lower_bound(offset);
+    if (prev != spill_free_extents.begin()) {
+        --prev;
+        if (prev->first + prev->second == offset) {
+            offset = prev->first;
+            size += prev->second;
+            spill_free_extents_by_size.erase({prev->second, prev->first});
+            spill_free_bytes -= prev->second;
+            spill_free_extents.erase(prev);
+        }
+    }
+
+    if (offset + size == spill_file_size) {
+        // Free space at the end is simply dropped. The file itself is not truncated.
+        spill_file_size = offset;
+        return;
+    }
+
+    spill_free_extents[offset] = size;
+    spill_free_extents_by_size.insert({size, offset});
+    spill_free_bytes += size;
+}
+
+double StateTree::node_memory(const Node& _node)
+{
+    return (_node.children.capacity() * sizeof(HashValue))
+         + (_node.path.capacity() * sizeof(uint32_t))
+         + candidate_memory(_node);
+}
+
+double StateTree::candidate_memory(const Node& _node)
+{
+    return _node.candidates.capacity() * sizeof(uint32_t);
+}
+
+}
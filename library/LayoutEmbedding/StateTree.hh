@@ -0,0 +1,116 @@
+#pragma once
+
+#include <LayoutEmbedding/ConflictGraph.hh>
+#include <LayoutEmbedding/Hash.hh>
+#include <LayoutEmbedding/VirtualPath.hh>
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <list>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+namespace LayoutEmbedding {
+
+/// Compact storage of the branch-and-bound state tree.
+/// - Paths are stored as packed virtual vertices (32 bit each).
+/// - Candidate paths are stored as a delta against the parent state (only the paths that changed).
+/// - Candidate conflicts are stored as a triangular bitset or as a list of packed pairs, whichever is smaller.
+/// - Optionally, a memory budget for the candidate data can be set. If it is exceeded, the candidate data of the
+///   least recently used states is spilled to a temporary file and read back on demand.
+///   The tree structure (children, inserted paths) always stays in memory and does not count against the budget.
+///   The file space of removed states is reused by later spills.
+/// The root state has hash 0 and stores all candidate paths.
+/// Not thread-safe.
+class StateTree
+{
+public:
+    using CandidateConflicts = ConflictGraph;
+
+    /// Candidate data of a state, encoded relative to its parent.
+    /// Can be created without access to the tree (e.g. outside of a lock).
+    using EncodedCandidates = std::vector<uint32_t>;
+
+    static EncodedCandidates encode(
+            const std::vector<VirtualPath>& _candidate_paths,
+            const std::vector<VirtualPath>& _parent_candidate_paths, // Empty for the root
+            const CandidateConflicts& _candidate_conflicts);
+
+    /// _memory_budget in Bytes of in-memory candidate data. Set to <= 0 to disable spilling.
+    explicit StateTree(int _num_layout_edges, double _memory_budget = 0.0);
+    ~StateTree();
+
+    StateTree(const StateTree&) = delete;
+    StateTree& operator=(const StateTree&) = delete;
+
+    void insert_root(const std::vector<VirtualPath>& _candidate_paths, const CandidateConflicts& _candidate_conflicts);
+    /// _verification_hash is an independent fingerprint of the state, used to detect hash collisions (0 if unused).
+    void insert(const HashValue _hash, const HashValue _parent, const pm::edge_index& _l_e, const VirtualPath& _path, EncodedCandidates&& _candidates, const HashValue _verification_hash = 0);
+
+    /// Removes a state without children (not the root).
+    void remove(const HashValue _hash);
+
+    bool contains(const HashValue _hash) const;
+    std::size_t size() const;
+
+    HashValue parent(const HashValue _hash) const;
+    const std::vector<HashValue>& children(const HashValue _hash) const;
+    pm::edge_index inserted_edge(const HashValue _hash) const;
+    VirtualPath inserted_path(const HashValue _hash) const;
+    HashValue verification_hash(const HashValue _hash) const;
+
+    std::vector<VirtualPath> candidate_paths(const HashValue _hash);
+    CandidateConflicts candidate_conflicts(const HashValue _hash);
+
+    double memory_estimate() const; // Bytes, excluding spilled data
+    double spilled_bytes() const; // Excluding file space that is free for reuse
+
+private:
+    struct Node
+    {
+        HashValue parent = 0;
+        HashValue verification_hash = 0;
+        std::vector<HashValue> children;
+        uint32_t l_e = 0;
+        std::vector<uint32_t> path; // Packed virtual vertices
+        EncodedCandidates candidates; // Empty if spilled
+        int64_t spill_offset = -1;
+        uint32_t spill_size = 0;
+        std::list<HashValue>::iterator lru_it;
+    };
+
+    Node& node(const HashValue _hash);
+    const Node& node(const HashValue _hash) const;
+
+    // Returns the candidate data of a node, reading it from the spill file if necessary.
+    const EncodedCandidates& load(const HashValue _hash, EncodedCandidates& _buffer);
+
+    void touch(Node& _node);
+    void enforce_memory_budget();
+
+    // Best-fit allocation in the spill file. Adjacent free extents are merged.
+    int64_t allocate_spill_extent(const int64_t _bytes);
+    void free_spill_extent(const int64_t _offset, const int64_t _bytes);
+    static double node_memory(const Node& _node);
+    static double candidate_memory(const Node& _node); // Part of node_memory() that can be spilled
+
+    int num_layout_edges;
+    double memory_budget;
+
+    std::unordered_map<HashValue, Node> nodes;
+    std::list<HashValue> lru; // In-memory candidate data, least recently used first
+    double memory_in_use = 0.0;
+    double candidate_memory_in_use = 0.0; // Checked against memory_budget
+
+    std::filesystem::path spill_path;
+    std::fstream spill_file;
+    int64_t spill_file_size = 0;
+    int64_t spill_free_bytes = 0;
+    std::map<int64_t, int64_t> spill_free_extents; // Offset -> size
+    std::set<std::pair<int64_t, int64_t>> spill_free_extents_by_size; // (size, offset)
+};
+
+}
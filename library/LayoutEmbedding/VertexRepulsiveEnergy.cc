@@ -1,6 +1,11 @@
 #include "VertexRepulsiveEnergy.hh"
 
+#include <LayoutEmbedding/Embedding.hh>
 #include <LayoutEmbedding/Harmonic.hh>
+#include <LayoutEmbedding/Util/Assert.hh>
+
+#include <algorithm>
+#include <iostream>
 
 namespace LayoutEmbedding {
 
@@ -27,4 +32,222 @@ Eigen::MatrixXd compute_vertex_repulsive_energy(const Embedding& _em)
     return W;
 }
 
+VertexRepulsiveEnergy::VertexRepulsiveEnergy(const Embedding& _em, const int _max_num_fields, const HarmonicSolverMethod _method) :
+    num_fields(_em.layout_mesh().vertices().size()),
+    num_initial_vertices(_em.target_mesh().vertices().size()),
+    max_num_fields(_max_num_fields)
+{
+    // Each path query alternates between the fields of its start and end vertex, a single field would be recomputed constantly
+    LE_ASSERT(_max_num_fields == 0 || _max_num_fields >= 2);
+
+    auto constrained = _em.target_mesh().vertices().make_attribute<bool>(false);
+    for (const auto l_v : _em.layout_mesh().vertices())
+    {
+        const auto t_v = _em.matching_target_vertex(l_v);
+        constrained[t_v] = true;
+        t_constrained.push_back(t_v.idx.value);
+    }
+
+    solver = std::make_shared<const HarmonicSolver>(_em.target_pos(), constrained, LaplaceWeights::MeanValue, _method);
+    if (!solver->ok() && _method == HarmonicSolverMethod::Direct)
+    {
+        std::cout << "Vertex repulsive energy: Factorization failed. Falling back to the iterative solver." << std::endl;
+        solver = std::make_shared<const HarmonicSolver>(_em.target_pos(), constrained, LaplaceWeights::MeanValue, HarmonicSolverMethod::Iterative);
+    }
+    LE_ASSERT(solver->ok());
+    if (solver->is_iterative())
+    {
+        iterative_solver_mutex = std::make_shared<std::mutex>();
+    }
+
+    if (max_num_fields == 0)
+    {
+        // Solve a few fields at a time, so the double precision solution never exceeds a small block
+        const int block_size = 8;
+        auto data = std::make_shared<std::vector<float>>((size_t)num_initial_vertices * num_fields);
+        for (int l_vi_begin = 0; l_vi_begin < num_fields; l_vi_begin += block_size)
+        {
+            const int k = std::min(block_size, num_fields - l_vi_begin);
+            Eigen::MatrixXd constraint_values = Eigen::MatrixXd::Zero(num_initial_vertices, k);
+            for (int j = 0; j < k; ++j)
+            {
+                constraint_values(t_constrained[l_vi_begin + j], j) = 1.0;
+            }
+            Eigen::MatrixXd W;
+            LE_ASSERT(solver->solve(constraint_values, W));
+            for (int t_vi = 0; t_vi < num_initial_vertices; ++t_vi)
+            {
+                for (int j = 0; j < k; ++j)
+                {
+                    (*data)[(size_t)t_vi * num_fields + l_vi_begin + j] = W(t_vi, j);
+                }
+            }
+        }
+        initial_data = std::move(data);
+        solver.reset();
+    }
+}
+
+VertexRepulsiveEnergy::VertexRepulsiveEnergy(const VertexRepulsiveEnergy& _vre) :
+    num_fields(_vre.num_fields),
+    num_initial_vertices(_vre.num_initial_vertices),
+    split_parents(_vre.split_parents),
+    initial_data(_vre.initial_data),
+    split_data(_vre.split_data),
+    max_num_fields(_vre.max_num_fields),
+    t_constrained(_vre.t_constrained),
+    solver(_vre.solver),
+    iterative_solver_mutex(_vre.iterative_solver_mutex)
+{
+    std::lock_guard<std::mutex> lock(_vre.mutex);
+    for (const int l_vi : _vre.lru)
+    {
+        lru.push_back(l_vi);
+        fields[l_vi] = {_vre.fields.at(l_vi).first, std::prev(lru.end())};
+    }
+}
+
+double VertexRepulsiveEnergy::value(const int _t_vi, const int _l_vi) const
+{
+    LE_ASSERT_GEQ(_t_vi, 0);
+    LE_ASSERT_L(_t_vi, num_vertices());
+    LE_ASSERT_GEQ(_l_vi, 0);
+    LE_ASSERT_L(_l_vi, num_fields);
+
+    if (max_num_fields == 0)
+    {
+        if (_t_vi < num_initial_vertices)
+            return (*initial_data)[(size_t)_t_vi * num_fields + _l_vi];
+        return split_data[(size_t)(_t_vi - num_initial_vertices) * num_fields + _l_vi];
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = fields.find(_l_vi);
+        if (it != fields.end())
+        {
+            lru.splice(lru.end(), lru, it->second.second);
+            Field& field = it->second.first;
+            if ((int)field.size() <= _t_vi)
+            {
+                extend_field(field);
+            }
+            return field[_t_vi];
+        }
+    }
+
+    // Solve without holding the lock, so lookups (and solves of other fields) can proceed concurrently.
+    // If another thread computes the same field in the meantime, its result is kept and this one is discarded.
+    Field field = compute_field(_l_vi);
+    const double result = field[_t_vi];
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = fields.find(_l_vi);
+    if (it == fields.end())
+    {
+        if ((int)fields.size() >= max_num_fields)
+        {
+            fields.erase(lru.front());
+            lru.pop_front();
+        }
+        lru.push_back(_l_vi);
+        fields.emplace(_l_vi, std::make_pair(std::move(field), std::prev(lru.end())));
+    }
+    else
+    {
+        lru.splice(lru.end(), lru, it->second.second);
+    }
+    return result;
+}
+
+void VertexRepulsiveEnergy::add_split_vertex(const int _t_vi_new, const int _t_vi_A, const int _t_vi_B)
+{
+    LE_ASSERT_EQ(_t_vi_new, num_vertices());
+    LE_ASSERT_L(_t_vi_A, _t_vi_new);
+    LE_ASSERT_L(_t_vi_B, _t_vi_new);
+
+    split_parents.push_back({_t_vi_A, _t_vi_B});
+
+    // Cached fields (on-demand mode) are extended lazily
+    if (max_num_fields == 0)
+    {
+        split_data.resize(split_data.size() + num_fields);
+        auto row = [&] (const int _t_vi) -> const float* {
+            if (_t_vi < num_initial_vertices)
+                return initial_data->data() + (size_t)_t_vi * num_fields;
+            return split_data.data() + (size_t)(_t_vi - num_initial_vertices) * num_fields;
+        };
+        const float* row_A = row(_t_vi_A);
+        const float* row_B = row(_t_vi_B);
+        float* row_new = split_data.data() + (size_t)(_t_vi_new - num_initial_vertices) * num_fields;
+        for (int i = 0; i < num_fields; ++i)
+        {
+            row_new[i] = 0.5f * row_A[i] + 0.5f * row_B[i];
+        }
+    }
+}
+
+void VertexRepulsiveEnergy::truncate(const int _num_vertices)
+{
+    LE_ASSERT_GEQ(_num_vertices, num_initial_vertices);
+    LE_ASSERT_LEQ(_num_vertices, num_vertices());
+
+    split_parents.resize(_num_vertices - num_initial_vertices);
+    if (max_num_fields == 0)
+    {
+        split_data.resize((size_t)(_num_vertices - num_initial_vertices) * num_fields);
+    }
+    else
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& [l_vi, entry] : fields)
+        {
+            if ((int)entry.first.size() > _num_vertices)
+            {
+                entry.first.resize(_num_vertices);
+            }
+        }
+    }
+}
+
+int VertexRepulsiveEnergy::num_vertices() const
+{
+    return num_initial_vertices + split_parents.size();
+}
+
+VertexRepulsiveEnergy::Field VertexRepulsiveEnergy::compute_field(const int _l_vi) const
+{
+    LE_ASSERT(solver);
+    Eigen::MatrixXd constraint_values = Eigen::MatrixXd::Zero(num_initial_vertices, 1);
+    constraint_values(t_constrained[_l_vi], 0) = 1.0;
+
+    Eigen::MatrixXd w;
+    if (iterative_solver_mutex)
+    {
+        std::lock_guard<std::mutex> lock(*iterative_solver_mutex);
+        LE_ASSERT(solver->solve(constraint_values, w));
+    }
+    else
+    {
+        LE_ASSERT(solver->solve(constraint_values, w));
+    }
+
+    Field field(num_initial_vertices);
+    for (int t_vi = 0; t_vi < num_initial_vertices; ++t_vi)
+    {
+        field[t_vi] = w(t_vi, 0);
+    }
+    extend_field(field);
+    return field;
+}
+
+void VertexRepulsiveEnergy::extend_field(Field& _field) const
+{
+    for (int t_vi = _field.size(); t_vi < num_vertices(); ++t_vi)
+    {
+        const auto& [t_vi_A, t_vi_B] = split_parents[t_vi - num_initial_vertices];
+        _field.push_back(0.5f * _field[t_vi_A] + 0.5f * _field[t_vi_B]);
+    }
+}
+
 }
@@ -1,11 +1,74 @@
 #pragma once
 
-#include <LayoutEmbedding/Embedding.hh>
+#include <LayoutEmbedding/Harmonic.hh>
 
 #include <Eigen/Dense>
 
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
 namespace LayoutEmbedding {
 
+class Embedding;
+
 Eigen::MatrixXd compute_vertex_repulsive_energy(const Embedding& _em);
 
+/// Compact storage of the vertex repulsive energy [Praun2001]: One harmonic field per layout vertex,
+/// which is 1 at its matching target vertex and 0 at all other matching target vertices.
+/// Values are stored as float.
+/// - Dense mode: All fields in contiguous row-major buffers (one row per target vertex).
+///   The rows of the initial target vertices are shared among copies, only split vertices are stored per copy.
+/// - On-demand mode: Only the most recently used fields are kept. Missing fields are solved
+///   with a factorization of the Laplacian that is computed once and shared among copies.
+/// If the direct factorization fails, the iterative solver is used instead.
+/// Fields are computed on the target mesh at construction.
+/// Vertices created by later edge splits are appended and interpolated from the edge endpoints.
+class VertexRepulsiveEnergy
+{
+public:
+    /// _max_num_fields: Number of fields kept in on-demand mode, at least 2. 0 computes and stores all fields (dense mode).
+    explicit VertexRepulsiveEnergy(const Embedding& _em, const int _max_num_fields = 0, const HarmonicSolverMethod _method = HarmonicSolverMethod::Direct);
+
+    VertexRepulsiveEnergy(const VertexRepulsiveEnergy& _vre);
+    VertexRepulsiveEnergy& operator=(const VertexRepulsiveEnergy& _vre) = delete;
+
+    /// Can be called concurrently.
+    double value(const int _t_vi, const int _l_vi) const;
+
+    /// _t_vi_new has to be the next vertex index.
+    void add_split_vertex(const int _t_vi_new, const int _t_vi_A, const int _t_vi_B);
+
+    /// Removes all vertices with index >= _num_vertices, e.g. after a rollback.
+    void truncate(const int _num_vertices);
+
+    int num_vertices() const;
+
+private:
+    using Field = std::vector<float>; // One value per target vertex
+
+    Field compute_field(const int _l_vi) const;
+    void extend_field(Field& _field) const; // Appends the missing split vertices
+
+    int num_fields; // Number of layout vertices
+    int num_initial_vertices;
+    std::vector<std::pair<int, int>> split_parents; // Edge endpoints of the vertices created by splits, starting at num_initial_vertices
+
+    // Dense mode. Row-major, num_fields values per row.
+    std::shared_ptr<const std::vector<float>> initial_data; // Rows of the initial vertices
+    std::vector<float> split_data; // Rows of the split vertices
+
+    // On-demand mode
+    int max_num_fields;
+    std::vector<int> t_constrained; // Matching target vertex of each layout vertex
+    std::shared_ptr<const HarmonicSolver> solver;
+    std::shared_ptr<std::mutex> iterative_solver_mutex; // Iterative solves are not thread-safe. Shared among copies, like the solver.
+    mutable std::list<int> lru; // Layout vertices of the cached fields, least recently used first
+    mutable std::unordered_map<int, std::pair<Field, std::list<int>::iterator>> fields;
+    mutable std::mutex mutex;
+};
+
 }
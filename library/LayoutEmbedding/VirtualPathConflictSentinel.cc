@@ -3,110 +3,186 @@
 #include <LayoutEmbedding/Util/Assert.hh>
 #include <LayoutEmbedding/Connectivity.hh>
 
+#include <algorithm>
 #include <unordered_map>
 
 namespace LayoutEmbedding {
 
 VirtualPathConflictSentinel::VirtualPathConflictSentinel(const Embedding& _em) :
-    em(_em),
-    v_label(em.target_mesh()),
-    e_label(em.target_mesh()),
-    f_label(em.target_mesh()),
-    l_port(em.layout_mesh())
+    conflict_relation(_em.layout_mesh().all_edges().size()),
+    use_label_mask(_em.layout_mesh().all_edges().size() <= 64),
+    label_elements(_em.layout_mesh().all_edges().size()),
+    l_port_to(_em.layout_mesh().all_halfedges().size()),
+    l_vertex_ordering_conflicts(_em.layout_mesh().all_vertices().size())
 {
 }
 
-void VirtualPathConflictSentinel::insert(const pm::vertex_handle& _v, const VirtualPathConflictSentinel::Label& _l)
+int VirtualPathConflictSentinel::port_slot(const pm::halfedge_handle& _l_he)
 {
-    for (const auto& prev_l : v_label[_v]) {
-        mark_conflicting(_l, prev_l);
+    const auto l_e = _l_he.edge();
+    return 2 * l_e.idx.value + (_l_he == l_e.halfedgeA() ? 0 : 1);
+}
+
+VirtualPort VirtualPathConflictSentinel::l_port(const Embedding& _em, const pm::halfedge_handle& _l_he) const
+{
+    const auto& to = l_port_to[port_slot(_l_he)];
+    LE_ASSERT(is_valid(to));
+    return VirtualPort(_em.matching_target_vertex(_l_he.vertex_from()), to);
+}
+
+VirtualPathConflictSentinel::Element VirtualPathConflictSentinel::vertex_element(const pm::vertex_handle& _v)
+{
+    return (Element(0) << 32) | (uint32_t)_v.idx.value;
+}
+
+VirtualPathConflictSentinel::Element VirtualPathConflictSentinel::edge_element(const pm::edge_handle& _e)
+{
+    return (Element(1) << 32) | (uint32_t)_e.idx.value;
+}
+
+VirtualPathConflictSentinel::Element VirtualPathConflictSentinel::face_element(const pm::face_handle& _f)
+{
+    return (Element(2) << 32) | (uint32_t)_f.idx.value;
+}
+
+bool VirtualPathConflictSentinel::ElementLabels::empty() const
+{
+    return mask == 0 && num_inline == 0 && overflow.empty();
+}
+
+bool VirtualPathConflictSentinel::ElementLabels::contains(const VirtualPathConflictSentinel::Label& _l) const
+{
+    if (_l.value < 64 && ((mask >> _l.value) & 1)) {
+        return true;
     }
-    v_label[_v].insert(_l);
+    for (int i = 0; i < num_inline; ++i) {
+        if (inline_labels[i] == _l) {
+            return true;
+        }
+    }
+    return std::find(overflow.begin(), overflow.end(), _l) != overflow.end();
 }
 
-void VirtualPathConflictSentinel::insert(const pm::edge_handle& _e, const VirtualPathConflictSentinel::Label& _l)
+void VirtualPathConflictSentinel::ElementLabels::add(const VirtualPathConflictSentinel::Label& _l, bool _use_mask)
 {
-    for (const auto& prev_l : e_label[_e]) {
-        mark_conflicting(_l, prev_l);
+    if (_use_mask) {
+        mask |= uint64_t(1) << _l.value;
+    }
+    else if (num_inline < (int)inline_labels.size()) {
+        inline_labels[num_inline++] = _l;
+    }
+    else {
+        overflow.push_back(_l);
     }
-    e_label[_e].insert(_l);
 }
 
-void VirtualPathConflictSentinel::insert(const pm::face_handle& _f, const VirtualPathConflictSentinel::Label& _l)
+void VirtualPathConflictSentinel::ElementLabels::remove(const VirtualPathConflictSentinel::Label& _l, bool _use_mask)
 {
-    for (const auto& prev_l : f_label[_f]) {
-        mark_conflicting(_l, prev_l);
+    if (_use_mask) {
+        mask &= ~(uint64_t(1) << _l.value);
+        return;
     }
-    f_label[_f].insert(_l);
+    for (int i = 0; i < num_inline; ++i) {
+        if (inline_labels[i] == _l) {
+            // Refill the inline slot from the overflow (or from the last inline slot)
+            if (!overflow.empty()) {
+                inline_labels[i] = overflow.back();
+                overflow.pop_back();
+            }
+            else {
+                inline_labels[i] = inline_labels[--num_inline];
+            }
+            return;
+        }
+    }
+    const auto it = std::find(overflow.begin(), overflow.end(), _l);
+    LE_ASSERT(it != overflow.end());
+    overflow.erase(it);
+}
+
+void VirtualPathConflictSentinel::insert(const VirtualPathConflictSentinel::Element& _x, const VirtualPathConflictSentinel::Label& _l)
+{
+    auto& labels = element_labels[_x];
+    if (labels.contains(_l)) {
+        return;
+    }
+    labels.for_each([&](const Label& _prev_l) {
+        mark_conflicting(_l, _prev_l);
+    });
+    labels.add(_l, use_label_mask);
+    label_elements[_l.value].push_back(_x);
 }
 
-void VirtualPathConflictSentinel::insert_virtual_vertex(const VirtualVertex& _vv, const VirtualPathConflictSentinel::Label& _l)
+void VirtualPathConflictSentinel::insert_virtual_vertex(const Embedding& _em, const VirtualVertex& _vv, const VirtualPathConflictSentinel::Label& _l)
 {
     if (is_real_vertex(_vv)) {
-        insert(real_vertex(_vv, em.target_mesh()), _l);
+        insert(vertex_element(real_vertex(_vv, _em.target_mesh())), _l);
     }
     else {
-        insert(real_edge(_vv, em.target_mesh()), _l);
+        insert(edge_element(real_edge(_vv, _em.target_mesh())), _l);
     }
 }
 
-void VirtualPathConflictSentinel::insert_segment(const VirtualVertex& _vv0, const VirtualVertex& _vv1, const VirtualPathConflictSentinel::Label& _l)
+void VirtualPathConflictSentinel::insert_segment(const Embedding& _em, const VirtualVertex& _vv0, const VirtualVertex& _vv1, const VirtualPathConflictSentinel::Label& _l)
 {
+    const auto& t_m = _em.target_mesh();
     if (is_real_vertex(_vv0)) {
         if (is_real_vertex(_vv1)) {
             // (V,V) case
-            const auto& v0 = real_vertex(_vv0, em.target_mesh());
-            const auto& v1 = real_vertex(_vv1, em.target_mesh());
+            const auto& v0 = real_vertex(_vv0, t_m);
+            const auto& v1 = real_vertex(_vv1, t_m);
 
             const auto& he = pm::halfedge_from_to(v0, v1);
             LE_ASSERT(he.is_valid());
             const auto& e = he.edge();
-            insert(e, _l);
+            insert(edge_element(e), _l);
         }
         else {
             // (V,E) case
-            const auto& v = real_vertex(_vv0, em.target_mesh());
-            const auto& e = real_edge(_vv1, em.target_mesh());
+            const auto& v = real_vertex(_vv0, t_m);
+            const auto& e = real_edge(_vv1, t_m);
 
             const auto& f = triangle_with_edge_and_opposite_vertex(e, v);
             LE_ASSERT(f.is_valid());
-            insert(f, _l);
+            insert(face_element(f), _l);
         }
     }
     else {
         if (is_real_vertex(_vv1)) {
             // (E,V) case
-            const auto& e = real_edge(_vv0, em.target_mesh());
-            const auto& v = real_vertex(_vv1, em.target_mesh());
+            const auto& e = real_edge(_vv0, t_m);
+            const auto& v = real_vertex(_vv1, t_m);
 
             const auto& f = triangle_with_edge_and_opposite_vertex(e, v);
             LE_ASSERT(f.is_valid());
-            insert(f, _l);
+            insert(face_element(f), _l);
         }
         else {
             // (E,E) case
-            const auto& e0 = real_edge(_vv0, em.target_mesh());
-            const auto& e1 = real_edge(_vv1, em.target_mesh());
+            const auto& e0 = real_edge(_vv0, t_m);
+            const auto& e1 = real_edge(_vv1, t_m);
 
             const auto& f = common_face(e0, e1);
             LE_ASSERT(f.is_valid());
-            insert(f, _l);
+            insert(face_element(f), _l);
         }
     }
 }
 
-void VirtualPathConflictSentinel::insert_path(const VirtualPath& _path, const VirtualPathConflictSentinel::Label& _l)
+void VirtualPathConflictSentinel::insert_path(const Embedding& _em, const VirtualPath& _path, const VirtualPathConflictSentinel::Label& _l)
 {
     LE_ASSERT_GEQ(_path.size(), 2);
+    LE_ASSERT(!contains(_l));
+    LE_ASSERT(!_em.is_embedded(_l));
 
     // Note: We deliberately skip the first and last element
     for (int i = 1; i < _path.size() - 1; ++i) {
-        insert_virtual_vertex(_path[i], _l);
+        insert_virtual_vertex(_em, _path[i], _l);
     }
 
     // Path segments ("virtual edges")
     for (int i = 0; i < _path.size() - 1; ++i) {
-        insert_segment(_path[i], _path[i+1], _l);
+        insert_segment(_em, _path[i], _path[i+1], _l);
     }
 
     // Additionally remember the directions (ports) through wich the path leaves / enters its endpoints.
@@ -115,195 +191,257 @@ void VirtualPathConflictSentinel::insert_path(const VirtualPath& _path, const Vi
 
     // Warning: Here we rely on the assumption that for each edge l_e, the corresponding path was traced
     // using find_shortest_path(l_e.halfedgeA());
-    const pm::edge_handle l_e = em.layout_mesh().edges()[_l];
-    LE_ASSERT(em.matching_target_vertex(l_e.halfedgeA().vertex_from()) == real_vertex(_path.front()));
-    LE_ASSERT(em.matching_target_vertex(l_e.halfedgeA().vertex_to()) == real_vertex(_path.back()));
+    const pm::edge_handle l_e = _em.layout_mesh().edges()[_l];
+    LE_ASSERT(_em.matching_target_vertex(l_e.halfedgeA().vertex_from()) == real_vertex(_path.front()));
+    LE_ASSERT(_em.matching_target_vertex(l_e.halfedgeA().vertex_to()) == real_vertex(_path.back()));
 
-    const VirtualPort port_A(real_vertex(_path[0], em.target_mesh()), _path[1]);
-    const VirtualPort port_B(real_vertex(_path[_path.size()-1], em.target_mesh()), _path[_path.size()-2]);
     // Links from layout to target
-    l_port[l_e.halfedgeA()] = port_A;
-    l_port[l_e.halfedgeB()] = port_B;
+    l_port_to[port_slot(l_e.halfedgeA())] = _path[1];
+    l_port_to[port_slot(l_e.halfedgeB())] = _path[_path.size()-2];
+}
+
+void VirtualPathConflictSentinel::remove_path(const VirtualPathConflictSentinel::Label& _l)
+{
+    for (const auto& x : label_elements[_l.value]) {
+        auto it = element_labels.find(x);
+        LE_ASSERT(it != element_labels.end());
+        auto& labels = it->second;
+        labels.remove(_l, use_label_mask);
+        labels.for_each([&](const Label& _other_l) {
+            unmark_conflicting(_l, _other_l);
+        });
+        if (labels.empty()) {
+            element_labels.erase(it);
+        }
+    }
+    label_elements[_l.value].clear();
+
+    l_port_to[2 * _l.value] = VirtualVertex();
+    l_port_to[2 * _l.value + 1] = VirtualVertex();
+}
+
+bool VirtualPathConflictSentinel::contains(const VirtualPathConflictSentinel::Label& _l) const
+{
+    return is_valid(l_port_to[2 * _l.value]);
 }
 
 void VirtualPathConflictSentinel::mark_conflicting(const VirtualPathConflictSentinel::Label& _a, const VirtualPathConflictSentinel::Label& _b)
 {
-    LE_ASSERT(!em.is_embedded(_a));
-    LE_ASSERT(!em.is_embedded(_b));
+    if (_a == _b) {
+        return;
+    }
 
+    const Conflict sorted = std::minmax(_a, _b);
+    if (conflict_count[sorted]++ == 0) {
+        conflict_relation.insert(sorted.first, sorted.second);
+    }
+}
+
+void VirtualPathConflictSentinel::unmark_conflicting(const VirtualPathConflictSentinel::Label& _a, const VirtualPathConflictSentinel::Label& _b)
+{
     if (_a == _b) {
         return;
     }
 
     const Conflict sorted = std::minmax(_a, _b);
-    conflict_relation.insert(sorted);
+    auto it = conflict_count.find(sorted);
+    LE_ASSERT(it != conflict_count.end());
+    if (--it->second == 0) {
+        conflict_count.erase(it);
+        conflict_relation.erase(sorted.first, sorted.second);
+    }
 }
 
-void VirtualPathConflictSentinel::check_path_ordering()
+void VirtualPathConflictSentinel::check_path_ordering(const Embedding& _em)
 {
-    for (const auto l_v : em.layout_mesh().vertices()) {
-        bool vertex_has_sectors = false;
-        for (const auto l_sector_boundary_he : l_v.outgoing_halfedges()) {
-            if (em.is_embedded(l_sector_boundary_he)) {
-                vertex_has_sectors = true;
-
-                // A list of all unembedded layout edges that are in this sector,
-                // along with their corresponding embedded ports
-                std::vector<Label> labels_in_sector;
-                std::vector<VirtualPort> embedded_ports_in_sector;
-                {
-                    auto l_he_in_sector = rotated_ccw(l_sector_boundary_he);
-                    while (!em.is_embedded(l_he_in_sector)) {
-                        labels_in_sector.push_back(l_he_in_sector.edge());
-                        embedded_ports_in_sector.push_back(l_port[l_he_in_sector]);
-                        l_he_in_sector = rotated_ccw(l_he_in_sector);
-                    }
+    for (const auto l_v : _em.layout_mesh().vertices()) {
+        check_path_ordering(_em, l_v);
+    }
+}
+
+void VirtualPathConflictSentinel::check_path_ordering(const Embedding& _em, const pm::vertex_handle& _l_v)
+{
+    const auto& l_v = _l_v;
+    std::vector<Conflict> found;
+
+    bool vertex_has_sectors = false;
+    for (const auto l_sector_boundary_he : l_v.outgoing_halfedges()) {
+        if (_em.is_embedded(l_sector_boundary_he)) {
+            vertex_has_sectors = true;
+
+            // A list of all unembedded layout edges that are in this sector,
+            // along with their corresponding embedded ports
+            std::vector<Label> labels_in_sector;
+            std::vector<VirtualPort> embedded_ports_in_sector;
+            {
+                auto l_he_in_sector = rotated_ccw(l_sector_boundary_he);
+                while (!_em.is_embedded(l_he_in_sector)) {
+                    labels_in_sector.push_back(l_he_in_sector.edge());
+                    embedded_ports_in_sector.push_back(l_port(_em, l_he_in_sector));
+                    l_he_in_sector = rotated_ccw(l_he_in_sector);
                 }
-                LE_ASSERT_EQ(labels_in_sector.size(), embedded_ports_in_sector.size());
-
-                // This map assigns each unembedded layout edge in the sector an integer position
-                // that corresponds to its index in the fan of possible outgoing ports in the
-                // corresponding sector on the target mesh.
-                std::map<Label, int> embedded_port_pos;
-                {
-                    const auto& t_v = em.matching_target_vertex(l_v);
-                    const auto& t_he = em.get_embedded_target_halfedge(l_sector_boundary_he);
-                    const auto start_port = VirtualPort(t_v, t_he.vertex_to());
-                    auto current_port = start_port.rotated_ccw();
-                    int current_port_pos = 0;
-                    while (true) {
-                        if (is_real_vertex(current_port.to)) {
-                            const auto& t_he_current = current_port.real_halfedge();
-                            if (em.is_blocked(t_he_current.edge())) {
-                                // Reached end of sector
-                                break;
-                            }
+            }
+            LE_ASSERT_EQ(labels_in_sector.size(), embedded_ports_in_sector.size());
+
+            // This map assigns each unembedded layout edge in the sector an integer position
+            // that corresponds to its index in the fan of possible outgoing ports in the
+            // corresponding sector on the target mesh.
+            std::map<Label, int> embedded_port_pos;
+            {
+                const auto& t_v = _em.matching_target_vertex(l_v);
+                const auto& t_he = _em.get_embedded_target_halfedge(l_sector_boundary_he);
+                const auto start_port = VirtualPort(t_v, t_he.vertex_to());
+                auto current_port = start_port.rotated_ccw();
+                int current_port_pos = 0;
+                while (true) {
+                    if (is_real_vertex(current_port.to)) {
+                        const auto& t_he_current = current_port.real_halfedge();
+                        if (_em.is_blocked(t_he_current.edge())) {
+                            // Reached end of sector
+                            break;
                         }
+                    }
 
-                        // Store positions
-                        LE_ASSERT_EQ(labels_in_sector.size(), embedded_ports_in_sector.size());
-                        for (std::size_t i = 0; i < labels_in_sector.size(); ++i) {
-                            const auto& label = labels_in_sector[i];
-                            const auto& embedded_port = embedded_ports_in_sector[i];
-                            if (embedded_port == current_port) {
-                                embedded_port_pos[label] = current_port_pos;
-                            }
+                    // Store positions
+                    LE_ASSERT_EQ(labels_in_sector.size(), embedded_ports_in_sector.size());
+                    for (std::size_t i = 0; i < labels_in_sector.size(); ++i) {
+                        const auto& label = labels_in_sector[i];
+                        const auto& embedded_port = embedded_ports_in_sector[i];
+                        if (embedded_port == current_port) {
+                            embedded_port_pos[label] = current_port_pos;
                         }
-
-                        current_port = current_port.rotated_ccw();
-                        ++current_port_pos;
                     }
+
+                    current_port = current_port.rotated_ccw();
+                    ++current_port_pos;
                 }
-                // All incident edges in the layout sector should have a corresponding port in the target sector!
-                LE_ASSERT_EQ(labels_in_sector.size(), embedded_port_pos.size());
-
-                // Detect conflicting edges
-                for (std::size_t i = 0; i < labels_in_sector.size(); ++i) {
-                    const auto& label = labels_in_sector[i];
-                    const auto& port_pos = embedded_port_pos.at(label);
-
-                    for (std::size_t i_left = 0; i_left < i; ++i_left) {
-                        const auto& label_left = labels_in_sector[i_left];
-                        const auto& port_pos_left = embedded_port_pos.at(label_left);
-                        if (port_pos_left >= port_pos) {
-                            mark_conflicting(label, label_left);
-                        }
+            }
+            // All incident edges in the layout sector should have a corresponding port in the target sector!
+            LE_ASSERT_EQ(labels_in_sector.size(), embedded_port_pos.size());
+
+            // Detect conflicting edges
+            for (std::size_t i = 0; i < labels_in_sector.size(); ++i) {
+                const auto& label = labels_in_sector[i];
+                const auto& port_pos = embedded_port_pos.at(label);
+
+                for (std::size_t i_left = 0; i_left < i; ++i_left) {
+                    const auto& label_left = labels_in_sector[i_left];
+                    const auto& port_pos_left = embedded_port_pos.at(label_left);
+                    if (port_pos_left >= port_pos) {
+                        found.emplace_back(label, label_left);
                     }
+                }
 
-                    for (std::size_t i_right = i + 1; i_right < labels_in_sector.size(); ++i_right) {
-                        const auto& label_right = labels_in_sector[i_right];
-                        const auto& port_pos_right = embedded_port_pos.at(label_right);
-                        if (port_pos_right <= port_pos) {
-                            mark_conflicting(label, label_right);
-                        }
+                for (std::size_t i_right = i + 1; i_right < labels_in_sector.size(); ++i_right) {
+                    const auto& label_right = labels_in_sector[i_right];
+                    const auto& port_pos_right = embedded_port_pos.at(label_right);
+                    if (port_pos_right <= port_pos) {
+                        found.emplace_back(label, label_right);
                     }
                 }
             }
         }
+    }
 
-        if (!vertex_has_sectors) {
-            // Save back references -- from VirtualPorts around this vertex to corresponding layout halfedges.
-            std::unordered_map<VirtualPort, std::set<Label>> labels_at_port;
-            for (const auto l_he : l_v.outgoing_halfedges()) {
-                LE_ASSERT(!em.is_embedded(l_he));
-                const auto& port = l_port[l_he];
-                const auto& label = l_he.edge();
-                labels_at_port[port].insert(label);
-            }
+    if (!vertex_has_sectors) {
+        // Save back references -- from VirtualPorts around this vertex to corresponding layout halfedges.
+        std::unordered_map<VirtualPort, std::set<Label>> labels_at_port;
+        for (const auto l_he : l_v.outgoing_halfedges()) {
+            LE_ASSERT(!_em.is_embedded(l_he));
+            const auto port = l_port(_em, l_he);
+            const auto& label = l_he.edge();
+            labels_at_port[port].insert(label);
+        }
 
-            // Detect local violations of cyclic order
-            for (const auto l_he : l_v.outgoing_halfedges()) {
-                const pm::halfedge_handle& l_he_prev = rotated_cw(l_he);
-                const pm::halfedge_handle& l_he_next = rotated_ccw(l_he);
-
-                const Label& l_prev = l_he_prev.edge();
-                const Label& l      = l_he.edge();
-                const Label& l_next = l_he_next.edge();
-
-                const VirtualPort& port_prev = l_port[l_he_prev];
-                const VirtualPort& port      = l_port[l_he];
-                const VirtualPort& port_next = l_port[l_he_next];
-
-                LE_ASSERT(port_prev.is_valid());
-                LE_ASSERT(port.is_valid());
-                LE_ASSERT(port_next.is_valid());
-
-                // We check that port lies between port_prev and port_next.
-                // To do this, we start at port_prev, and rotate CCW until port is found.
-                // If any other embedded edge is encountered first, we have detected a conflict.
-                // We then repeat the same thing starting from port, trying to reach port_next.
-
-                bool valid = true;
-                auto port_current = port_prev;
-
-                // Check the sector from port_prev to port
-                while (port_current != port) {
-                    for (const auto& l_at_port : labels_at_port[port_current]) {
-                        // Any other labels at port_current?
-                        if (l_at_port != l_prev) {
-                            // --> Conflict
-                            valid = false;
-                            break;
-                        }
-                    }
-                    port_current = port_current.rotated_ccw();
-                }
+        // Detect local violations of cyclic order
+        for (const auto l_he : l_v.outgoing_halfedges()) {
+            const pm::halfedge_handle& l_he_prev = rotated_cw(l_he);
+            const pm::halfedge_handle& l_he_next = rotated_ccw(l_he);
 
-                LE_ASSERT(port_current == port);
+            const Label& l_prev = l_he_prev.edge();
+            const Label& l      = l_he.edge();
+            const Label& l_next = l_he_next.edge();
 
-                // Check the sector from port to port_next
-                while (port_current != port_next) {
-                    for (const auto& l_at_port : labels_at_port[port_current]) {
-                        // Any other labels at port_current?
-                        if (l_at_port != l) {
-                            // --> Conflict
-                            valid = false;
-                            break;
-                        }
+            const VirtualPort port_prev = l_port(_em, l_he_prev);
+            const VirtualPort port      = l_port(_em, l_he);
+            const VirtualPort port_next = l_port(_em, l_he_next);
+
+            LE_ASSERT(port_prev.is_valid());
+            LE_ASSERT(port.is_valid());
+            LE_ASSERT(port_next.is_valid());
+
+            // We check that port lies between port_prev and port_next.
+            // To do this, we start at port_prev, and rotate CCW until port is found.
+            // If any other embedded edge is encountered first, we have detected a conflict.
+            // We then repeat the same thing starting from port, trying to reach port_next.
+
+            bool valid = true;
+            auto port_current = port_prev;
+
+            // Check the sector from port_prev to port
+            while (port_current != port) {
+                for (const auto& l_at_port : labels_at_port[port_current]) {
+                    // Any other labels at port_current?
+                    if (l_at_port != l_prev) {
+                        // --> Conflict
+                        valid = false;
+                        break;
                     }
-                    port_current = port_current.rotated_ccw();
                 }
+                port_current = port_current.rotated_ccw();
+            }
 
-                LE_ASSERT(port_current == port_next);
+            LE_ASSERT(port_current == port);
 
-                for (const auto& l_at_port : labels_at_port[port_next]) {
-                    // Any other labels at port_next?
-                    if (l_at_port != l_next) {
+            // Check the sector from port to port_next
+            while (port_current != port_next) {
+                for (const auto& l_at_port : labels_at_port[port_current]) {
+                    // Any other labels at port_current?
+                    if (l_at_port != l) {
                         // --> Conflict
                         valid = false;
                         break;
                     }
                 }
+                port_current = port_current.rotated_ccw();
+            }
 
-                if (!valid) {
-                    // The current label (l) is marked as conflicting with all other incident labels around the vertex
-                    for (const auto other_l : l_v.edges()) {
-                        mark_conflicting(l, other_l);
-                    }
+            LE_ASSERT(port_current == port_next);
+
+            for (const auto& l_at_port : labels_at_port[port_next]) {
+                // Any other labels at port_next?
+                if (l_at_port != l_next) {
+                    // --> Conflict
+                    valid = false;
+                    break;
+                }
+            }
+
+            if (!valid) {
+                // The current label (l) is marked as conflicting with all other incident labels around the vertex
+                for (const auto other_l : l_v.edges()) {
+                    found.emplace_back(l, other_l);
                 }
             }
         }
     }
+
+    // Replace the conflicts previously found at this vertex
+    auto& ordering_conflicts = l_vertex_ordering_conflicts[l_v.idx.value];
+    for (const auto& [l_a, l_b] : ordering_conflicts) {
+        unmark_conflicting(l_a, l_b);
+    }
+    ordering_conflicts.clear();
+    for (const auto& [l_a, l_b] : found) {
+        if (l_a == l_b) {
+            continue;
+        }
+        const Conflict sorted = std::minmax(l_a, l_b);
+        if (std::find(ordering_conflicts.begin(), ordering_conflicts.end(), sorted) == ordering_conflicts.end()) {
+            ordering_conflicts.push_back(sorted);
+            mark_conflicting(l_a, l_b);
+        }
+    }
 }
 
 }
@@ -1,44 +1,106 @@
 #pragma once
 
+#include <LayoutEmbedding/ConflictGraph.hh>
 #include <LayoutEmbedding/Embedding.hh>
 #include <LayoutEmbedding/VirtualPath.hh>
 #include <LayoutEmbedding/VirtualPort.hh>
 #include <LayoutEmbedding/VirtualVertex.hh>
-#include <LayoutEmbedding/VirtualVertexAttribute.hh>
+
+#include <array>
+#include <map>
+#include <set>
+#include <unordered_map>
 
 namespace LayoutEmbedding {
 
+/// Detects conflicts among the candidate paths of unembedded layout edges.
+/// Two paths conflict if they share a target element, or if they leave a layout vertex in an order
+/// that is incompatible with the layout.
+/// Paths can be inserted and removed individually. Conflicts are reference counted, and the path ordering
+/// is only rechecked at the layout vertices passed to check_path_ordering().
+/// All data is stored by index, so the sentinel can be copied along with the Embedding it refers to.
 struct VirtualPathConflictSentinel
 {
-    const Embedding& em;
-
     using Segment = std::pair<VirtualVertex, VirtualVertex>;
     using Label = pm::edge_index;
-    using LabelSet = std::set<Label>;
 
     using Conflict = std::pair<Label, Label>;
-    using ConflictSet = std::set<Conflict>;
 
-    pm::vertex_attribute<LabelSet> v_label;
-    pm::edge_attribute<LabelSet> e_label;
-    pm::face_attribute<LabelSet> f_label;
+    ConflictGraph conflict_relation; // The pairs of labels which are conflicting
 
-    ConflictSet conflict_relation; // The pairs of labels which are conflicting
+    explicit VirtualPathConflictSentinel(const Embedding& _em);
 
-    pm::halfedge_attribute<VirtualPort> l_port;
+    /// The target elements covered by _path are derived from the current target mesh of _em.
+    void insert_path(const Embedding& _em, const VirtualPath& _path, const Label& _l);
 
-    explicit VirtualPathConflictSentinel(const Embedding& _em);
+    /// Does not access the target mesh, so it can be called after the mesh has been refined.
+    /// The path ordering at the endpoints of _l has to be rechecked afterwards.
+    void remove_path(const Label& _l);
+
+    bool contains(const Label& _l) const;
+
+    void check_path_ordering(const Embedding& _em);
+    void check_path_ordering(const Embedding& _em, const pm::vertex_handle& _l_v);
+
+private:
+    // Target vertex, edge, or face: (type << 32) | index
+    using Element = uint64_t;
+    static Element vertex_element(const pm::vertex_handle& _v);
+    static Element edge_element(const pm::edge_handle& _e);
+    static Element face_element(const pm::face_handle& _f);
 
-    void insert(const pm::vertex_handle& _v, const Label& _l);
-    void insert(const pm::edge_handle& _e, const Label& _l);
-    void insert(const pm::face_handle& _f, const Label& _l);
-    void insert_virtual_vertex(const VirtualVertex& _vv, const Label& _l);
-    void insert_segment(const VirtualVertex& _vv0, const VirtualVertex& _vv1, const Label& _l);
-    void insert_path(const VirtualPath& _path, const Label& _l);
+    // Labels at a single target element. Most elements carry one or two labels, which are stored inline.
+    // If the layout has at most 64 edges, the labels are stored as a bitmask instead.
+    struct ElementLabels
+    {
+        uint64_t mask = 0;
+        int num_inline = 0;
+        std::array<Label, 2> inline_labels;
+        std::vector<Label> overflow;
+
+        bool empty() const;
+        bool contains(const Label& _l) const;
+        void add(const Label& _l, bool _use_mask);
+        void remove(const Label& _l, bool _use_mask);
+
+        template <typename F>
+        void for_each(F&& _f) const
+        {
+            uint64_t m = mask;
+            for (int i = 0; m != 0; ++i, m >>= 1) {
+                if (m & 1) {
+                    _f(Label(i));
+                }
+            }
+            for (int i = 0; i < num_inline; ++i) {
+                _f(inline_labels[i]);
+            }
+            for (const auto& l : overflow) {
+                _f(l);
+            }
+        }
+    };
+
+    void insert(const Element& _x, const Label& _l);
+    void insert_virtual_vertex(const Embedding& _em, const VirtualVertex& _vv, const Label& _l);
+    void insert_segment(const Embedding& _em, const VirtualVertex& _vv0, const VirtualVertex& _vv1, const Label& _l);
+
+    static int port_slot(const pm::halfedge_handle& _l_he);
+    VirtualPort l_port(const Embedding& _em, const pm::halfedge_handle& _l_he) const;
 
     void mark_conflicting(const Label& _a, const Label& _b);
+    void unmark_conflicting(const Label& _a, const Label& _b);
+
+    bool use_label_mask;
+    std::unordered_map<Element, ElementLabels> element_labels; // Only elements covered by at least one path
+    std::vector<std::vector<Element>> label_elements; // Indexed by label
+
+    // First virtual vertex of each path after leaving its start (indexed by port_slot() of the layout halfedge).
+    // Together with the matching target vertex, this is the port of the layout halfedge.
+    std::vector<VirtualVertex> l_port_to;
 
-    void check_path_ordering();
+    std::map<Conflict, int> conflict_count; // Number of elements / layout vertices at which the two labels conflict
+    std::vector<std::vector<Conflict>> l_vertex_ordering_conflicts; // Indexed by layout vertex
 };
 
 }
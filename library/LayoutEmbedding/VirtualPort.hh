@@ -40,13 +40,7 @@ namespace std
             using namespace LayoutEmbedding;
             std::size_t result = 0;
             result = hash_combine(result, _x.from.idx.value);
-            result = hash_combine(result, _x.to.index());
-            if (is_real_vertex(_x.to)) {
-                result = hash_combine(result, real_vertex(_x.to).value);
-            }
-            else {
-                result = hash_combine(result, real_edge(_x.to).value);
-            }
+            result = hash_combine(result, _x.to.packed());
             return result;
         }
     };
@@ -14,28 +14,6 @@ bool is_valid(const VirtualVertex& _vv)
     }
 }
 
-bool is_real_vertex(const VirtualVertex& _el)
-{
-    return std::holds_alternative<pm::vertex_index>(_el);
-}
-
-bool is_real_edge(const VirtualVertex& _el)
-{
-    return std::holds_alternative<pm::edge_index>(_el);
-}
-
-pm::vertex_index real_vertex(const VirtualVertex& _el)
-{
-    LE_ASSERT(is_real_vertex(_el));
-    return std::get<pm::vertex_index>(_el);
-}
-
-pm::edge_index real_edge(const VirtualVertex& _el)
-{
-    LE_ASSERT(is_real_edge(_el));
-    return std::get<pm::edge_index>(_el);
-}
-
 pm::vertex_handle real_vertex(const VirtualVertex& _el, const pm::Mesh& _on_mesh)
 {
     return _on_mesh[real_vertex(_el)];
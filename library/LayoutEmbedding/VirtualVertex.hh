@@ -1,28 +1,93 @@
 #pragma once
 
+#include <LayoutEmbedding/Util/Assert.hh>
+
 #include <polymesh/pm.hh>
 
-#include <variant>
+#include <cstdint>
+#include <functional>
 #include <vector>
 
 namespace LayoutEmbedding {
 
-using VirtualVertex = std::variant<
-    pm::vertex_index,
-    pm::edge_index
->;
+/// Either a vertex or an edge (midpoint) of the target mesh, packed into 32 bits:
+/// The highest bit tags edges, the remaining bits store the index + 1 (0 encodes an invalid index).
+/// Ordering matches the former std::variant<pm::vertex_index, pm::edge_index>: vertices before edges, then by index.
+class VirtualVertex
+{
+public:
+    VirtualVertex() = default; // Invalid vertex
+    VirtualVertex(const pm::vertex_index& _v) : data(encode(_v.value)) { }
+    VirtualVertex(const pm::edge_index& _e) : data(encode(_e.value) | edge_tag) { }
+    VirtualVertex(const pm::vertex_handle& _v) : VirtualVertex(_v.idx) { }
+    VirtualVertex(const pm::edge_handle& _e) : VirtualVertex(_e.idx) { }
+
+    bool operator==(const VirtualVertex& _rhs) const { return data == _rhs.data; }
+    bool operator!=(const VirtualVertex& _rhs) const { return data != _rhs.data; }
+    bool operator<(const VirtualVertex& _rhs) const { return data < _rhs.data; }
+
+    bool is_edge() const { return data & edge_tag; }
+    int index() const { return (int)(data & ~edge_tag) - 1; }
+
+    /// Raw 32 bit representation, e.g. for compact storage or hashing.
+    uint32_t packed() const { return data; }
+    static VirtualVertex from_packed(const uint32_t _packed)
+    {
+        VirtualVertex vv;
+        vv.data = _packed;
+        return vv;
+    }
+
+private:
+    static constexpr uint32_t edge_tag = 1u << 31;
+
+    static uint32_t encode(const int _idx)
+    {
+        LE_ASSERT_GEQ(_idx, -1);
+        return (uint32_t)(_idx + 1);
+    }
+
+    uint32_t data = 0;
+};
 
 bool is_valid(const VirtualVertex& _vv);
 
-bool is_real_vertex(const VirtualVertex& _el);
-bool is_real_edge(const VirtualVertex& _el);
+inline bool is_real_vertex(const VirtualVertex& _el)
+{
+    return !_el.is_edge();
+}
+
+inline bool is_real_edge(const VirtualVertex& _el)
+{
+    return _el.is_edge();
+}
 
 // Warning: These will throw when the contained element does not match.
-pm::vertex_index real_vertex(const VirtualVertex& _el);
-pm::edge_index real_edge(const VirtualVertex& _el);
+inline pm::vertex_index real_vertex(const VirtualVertex& _el)
+{
+    LE_ASSERT(is_real_vertex(_el));
+    return pm::vertex_index(_el.index());
+}
+
+inline pm::edge_index real_edge(const VirtualVertex& _el)
+{
+    LE_ASSERT(is_real_edge(_el));
+    return pm::edge_index(_el.index());
+}
 
 // Convenience overloads that allow providing a mesh to construct the handle on
 pm::vertex_handle real_vertex(const VirtualVertex& _el, const pm::Mesh& _on_mesh);
 pm::edge_handle real_edge(const VirtualVertex& _el, const pm::Mesh& _on_mesh);
 
 }
+
+namespace std
+{
+    template<> struct hash<LayoutEmbedding::VirtualVertex>
+    {
+        std::size_t operator()(const LayoutEmbedding::VirtualVertex& _x) const noexcept
+        {
+            return std::hash<uint32_t>()(_x.packed());
+        }
+    };
+}
@@ -4,27 +4,33 @@
 
 #include <polymesh/pm.hh>
 
+#include <vector>
+
 namespace LayoutEmbedding {
 
+/// Per-element data for vertices and edges of a mesh.
+/// Unlike pm attributes, this is not registered with the mesh.
+/// Thus, multiple threads can create these on the same mesh concurrently.
+/// Does not follow topological changes of the mesh.
 template <typename T>
 struct VirtualVertexAttribute
 {
-    pm::vertex_attribute<T> v_a;
-    pm::edge_attribute<T> e_a;
+    std::vector<T> v_a;
+    std::vector<T> e_a;
 
     VirtualVertexAttribute(const pm::Mesh& _m) :
-        v_a(_m),
-        e_a(_m)
+        v_a(_m.all_vertices().size()),
+        e_a(_m.all_edges().size())
     {
     }
 
     T& operator[](const VirtualVertex& _el)
     {
         if (is_real_vertex(_el)) {
-            return v_a[real_vertex(_el)];
+            return v_a[real_vertex(_el).value];
         }
         else {
-            return e_a[real_edge(_el)];
+            return e_a[real_edge(_el).value];
         }
     }
 };